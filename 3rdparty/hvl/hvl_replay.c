@@ -14,8 +14,19 @@
 #include <stdlib.h>
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HVL_MIX_AVX2
+#endif
+
 #include "hvl_replay.h"
 
+static void hvl_SelectMixer( void );
+
 int32 stereopan_left[]  = { 128,  96,  64,  32,   0 };
 int32 stereopan_right[] = { 128, 160, 193, 225, 255 };
 
@@ -344,6 +355,7 @@ BOOL hvl_InitSubsong( struct hvl_tune *ht, uint32 nr )
 
 void hvl_InitReplayer( void )
 {
+  hvl_SelectMixer();
   hvl_GenPanningTables();
   hvl_GenSawtooth( &waves[WO_SAWTOOTH_04], 0x04 );
   hvl_GenSawtooth( &waves[WO_SAWTOOTH_08], 0x08 );
@@ -1878,7 +1890,11 @@ void hvl_set_audio( struct hvl_voice *voice, float64 freqf )
   }
 }
 
-void hvl_play_irq( struct hvl_tune *ht )
+/*
+** Advances the sequencer by one frame, everything hvl_play_irq does but
+** hand the voices over to the mixer.
+*/
+static void hvl_sequence_irq( struct hvl_tune *ht )
 {
   uint32 i;
 
@@ -1937,111 +1953,364 @@ void hvl_play_irq( struct hvl_tune *ht )
       ht->ht_GetNewPosition = 1;
     }
   }
+}
+
+void hvl_play_irq( struct hvl_tune *ht )
+{
+  uint32 i;
+
+  hvl_sequence_irq( ht );
 
   for( i=0; i<ht->ht_Channels; i++ )
     hvl_set_audio( &ht->ht_Voices[i], ht->ht_Frequency );
 }
 
-void hvl_mixchunk( struct hvl_tune *ht, uint32 samples, int8 *buf1, int8 *buf2, int32 bufmod )
+/*
+** Returns the number of samples hvl_DecodeFrame produces before
+** ht_SongEndReached is set, by running the sequencer alone, without
+** setting up or mixing any audio. The tune is put back the way it was,
+** so playback starts where it would have. Returns 0 if the state could
+** not be saved, or if the song has not ended after maxsamples, as jumps
+** can keep it from ever ending.
+*/
+uint32 hvl_ScanLength( struct hvl_tune *ht, uint32 maxsamples )
 {
-  const int8   *src[MAX_CHANNELS];
-  const int8   *rsrc[MAX_CHANNELS];
-  uint32  delta[MAX_CHANNELS];
-  uint32  rdelta[MAX_CHANNELS];
-  int32   vol[MAX_CHANNELS];
-  uint32  pos[MAX_CHANNELS];
-  uint32  rpos[MAX_CHANNELS];
-  uint32  cnt;
-  int32   panl[MAX_CHANNELS];
-  int32   panr[MAX_CHANNELS];
-//  uint32  vu[MAX_CHANNELS];
-  int32   a=0, b=0, j;
-  uint32  i, chans, loops;
-
-  chans = ht->ht_Channels;
-  for( i=0; i<chans; i++ )
-  {
-    delta[i] = ht->ht_Voices[i].vc_Delta;
-    vol[i]   = ht->ht_Voices[i].vc_VoiceVolume;
-    pos[i]   = ht->ht_Voices[i].vc_SamplePos;
-    src[i]   = ht->ht_Voices[i].vc_MixSource;
-    panl[i]  = ht->ht_Voices[i].vc_PanMultLeft;
-    panr[i]  = ht->ht_Voices[i].vc_PanMultRight;
+  struct hvl_voice *voices;
+  int8   *wavetab[MAX_CHANNELS];
+  uint32  i, samples, total;
+  uint32  PlayingTime;
+  uint16  PosJump, StepWaitFrames, PosJumpNote;
+  int16   Tempo, PosNr, NoteNr;
+  uint8   GetNewPosition, PatternBreak, SongEndReached;
+
+  voices = malloc( sizeof( ht->ht_Voices ) );
+  if( !voices )
+    return 0;
+
+  memcpy( voices, ht->ht_Voices, sizeof( ht->ht_Voices ) );
+  memcpy( wavetab, ht->ht_WaveformTab, sizeof( wavetab ) );
+  PlayingTime    = ht->ht_PlayingTime;
+  PosJump        = ht->ht_PosJump;
+  StepWaitFrames = ht->ht_StepWaitFrames;
+  PosJumpNote    = ht->ht_PosJumpNote;
+  Tempo          = ht->ht_Tempo;
+  PosNr          = ht->ht_PosNr;
+  NoteNr         = ht->ht_NoteNr;
+  GetNewPosition = ht->ht_GetNewPosition;
+  PatternBreak   = ht->ht_PatternBreak;
+  SongEndReached = ht->ht_SongEndReached;
 
-    /* Ring Modulation */
-    rdelta[i]= ht->ht_Voices[i].vc_RingDelta;
-    rpos[i]  = ht->ht_Voices[i].vc_RingSamplePos;
-    rsrc[i]  = ht->ht_Voices[i].vc_RingMixSource;
+  samples = ht->ht_Frequency/50/ht->ht_SpeedMultiplier;
+  total   = 0;
 
-//    vu[i] = 0;
+  while( !ht->ht_SongEndReached && total < maxsamples )
+  {
+    for( i=0; i<ht->ht_SpeedMultiplier; i++ )
+      hvl_sequence_irq( ht );
+    total += samples * ht->ht_SpeedMultiplier;
   }
 
-  do
+  if( !ht->ht_SongEndReached )
+    total = 0;
+
+  memcpy( ht->ht_Voices, voices, sizeof( ht->ht_Voices ) );
+  memcpy( ht->ht_WaveformTab, wavetab, sizeof( wavetab ) );
+  ht->ht_PlayingTime    = PlayingTime;
+  ht->ht_PosJump        = PosJump;
+  ht->ht_StepWaitFrames = StepWaitFrames;
+  ht->ht_PosJumpNote    = PosJumpNote;
+  ht->ht_Tempo          = Tempo;
+  ht->ht_PosNr          = PosNr;
+  ht->ht_NoteNr         = NoteNr;
+  ht->ht_GetNewPosition = GetNewPosition;
+  ht->ht_PatternBreak   = PatternBreak;
+  ht->ht_SongEndReached = SongEndReached;
+
+  free( voices );
+
+  return total;
+}
+
+/*
+** Runs the sequencer alone over up to samples samples of output, in whole
+** hvl_DecodeFrame units, like hvl_ScanLength but leaving the tune there.
+** The voices are set up for the mixer again by the next frame played,
+** only the phase of the waveforms differs from playing up to it.
+** Returns the number of samples skipped.
+*/
+uint32 hvl_Skip( struct hvl_tune *ht, uint32 samples )
+{
+  uint32 i, frame, total;
+
+  frame = ht->ht_Frequency/50/ht->ht_SpeedMultiplier*ht->ht_SpeedMultiplier;
+  total = 0;
+
+  while( total + frame <= samples )
   {
-    loops = samples;
-    for( i=0; i<chans; i++ )
+    for( i=0; i<ht->ht_SpeedMultiplier; i++ )
+      hvl_sequence_irq( ht );
+    total += frame;
+  }
+
+  return total;
+}
+
+/*
+** Mixing. Between two wraps of any voice the sample positions advance
+** evenly, so a run of output samples can be mixed several at a time.
+** The SIMD kernels write interleaved stereo, and give exactly what the
+** scalar code does: the same integer operations, saturated the same way.
+*/
+struct hvl_mixstate
+{
+  const int8 *src[MAX_CHANNELS];
+  const int8 *rsrc[MAX_CHANNELS];
+  uint32      delta[MAX_CHANNELS];
+  uint32      rdelta[MAX_CHANNELS];
+  uint32      pos[MAX_CHANNELS];
+  uint32      rpos[MAX_CHANNELS];
+  int32       vol[MAX_CHANNELS];
+  int32       panl[MAX_CHANNELS];
+  int32       panr[MAX_CHANNELS];
+  uint32      chans;
+  int32       mixgain;
+};
+
+typedef uint32 (*hvl_mixfunc)( struct hvl_mixstate *ms, uint32 loops, int16 *out );
+
+static inline void hvl_mix_sample( struct hvl_mixstate *ms, int16 *l, int16 *r )
+{
+  int32  a=0, b=0, j;
+  uint32 i;
+
+  for( i=0; i<ms->chans; i++ )
+  {
+    if( ms->rsrc[i] )
     {
-      if( pos[i] >= (0x280 << 16)) pos[i] -= 0x280<<16;
-      cnt = ((0x280<<16) - pos[i] - 1) / delta[i] + 1;
-      if( cnt < loops ) loops = cnt;
+      /* Ring Modulation */
+      j = ((ms->src[i][ms->pos[i]>>16]*ms->rsrc[i][ms->rpos[i]>>16])>>7)*ms->vol[i];
+      ms->rpos[i] += ms->rdelta[i];
+    } else {
+      j = ms->src[i][ms->pos[i]>>16]*ms->vol[i];
+    }
+
+    a += (j * ms->panl[i]) >> 7;
+    b += (j * ms->panr[i]) >> 7;
+    ms->pos[i] += ms->delta[i];
+  }
 
-      if( rsrc[i] )
+  a = (a*ms->mixgain)>>8;
+  b = (b*ms->mixgain)>>8;
+
+  // clamping
+  if (a<-0x8000) a=-0x8000;
+  if (a> 0x7fff) a= 0x7fff;
+  if (b<-0x8000) b=-0x8000;
+  if (b> 0x7fff) b= 0x7fff;
+  *l = a;
+  *r = b;
+}
+
+#if defined(__SSE2__)
+// low 32 bits of each product, which are the same signed or unsigned
+static inline __m128i hvl_mullo32( __m128i a, __m128i b )
+{
+  __m128i even = _mm_mul_epu32( a, b );
+  __m128i odd  = _mm_mul_epu32( _mm_srli_si128( a, 4 ), _mm_srli_si128( b, 4 ) );
+
+  return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ),
+                             _mm_shuffle_epi32( odd,  _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+static inline __m128i hvl_fetch4( const int8 *src, uint32 pos, uint32 delta )
+{
+  return _mm_set_epi32( src[(pos+delta*3)>>16], src[(pos+delta*2)>>16],
+                        src[(pos+delta)>>16],   src[pos>>16] );
+}
+
+// four output samples at a time, returns how many were mixed
+static uint32 hvl_mix_sse2( struct hvl_mixstate *ms, uint32 loops, int16 *out )
+{
+  __m128i gain = _mm_set1_epi32( ms->mixgain );
+  uint32  n, i;
+
+  for( n=0; n+4<=loops; n+=4 )
+  {
+    __m128i a = _mm_setzero_si128();
+    __m128i b = _mm_setzero_si128();
+
+    for( i=0; i<ms->chans; i++ )
+    {
+      __m128i j = hvl_fetch4( ms->src[i], ms->pos[i], ms->delta[i] );
+
+      if( ms->rsrc[i] )
       {
-        if( rpos[i] >= (0x280<<16)) rpos[i] -= 0x280<<16;
-        cnt = ((0x280<<16) - rpos[i] - 1) / rdelta[i] + 1;
-        if( cnt < loops ) loops = cnt;
+        /* Ring Modulation */
+        j = _mm_srai_epi32( hvl_mullo32( j, hvl_fetch4( ms->rsrc[i], ms->rpos[i], ms->rdelta[i] ) ), 7 );
+        ms->rpos[i] += ms->rdelta[i]*4;
       }
 
+      j = hvl_mullo32( j, _mm_set1_epi32( ms->vol[i] ) );
+      a = _mm_add_epi32( a, _mm_srai_epi32( hvl_mullo32( j, _mm_set1_epi32( ms->panl[i] ) ), 7 ) );
+      b = _mm_add_epi32( b, _mm_srai_epi32( hvl_mullo32( j, _mm_set1_epi32( ms->panr[i] ) ), 7 ) );
+      ms->pos[i] += ms->delta[i]*4;
     }
 
-    samples -= loops;
+    a = _mm_srai_epi32( hvl_mullo32( a, gain ), 8 );
+    b = _mm_srai_epi32( hvl_mullo32( b, gain ), 8 );
+
+    // saturating packs clamp like the scalar code
+    a = _mm_packs_epi32( a, a );
+    b = _mm_packs_epi32( b, b );
+    _mm_storeu_si128( (__m128i *)&out[n*2], _mm_unpacklo_epi16( a, b ) );
+  }
+
+  return n;
+}
+#endif
+
+#ifdef HVL_MIX_AVX2
+// eight output samples at a time, the gathers read up to three bytes past
+// the last position, which the voice buffers leave room for
+__attribute__((target("avx2")))
+static inline __m256i hvl_fetch8( const int8 *src, uint32 pos, __m256i steps )
+{
+  __m256i idx = _mm256_srli_epi32( _mm256_add_epi32( _mm256_set1_epi32( pos ), steps ), 16 );
+  __m256i v   = _mm256_i32gather_epi32( (const int *)src, idx, 1 );
+
+  return _mm256_srai_epi32( _mm256_slli_epi32( v, 24 ), 24 );
+}
 
-    // Inner loop
-    do
+__attribute__((target("avx2")))
+static uint32 hvl_mix_avx2( struct hvl_mixstate *ms, uint32 loops, int16 *out )
+{
+  const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+  __m256i steps[MAX_CHANNELS], rsteps[MAX_CHANNELS];
+  __m256i gain = _mm256_set1_epi32( ms->mixgain );
+  uint32  n, i;
+
+  for( i=0; i<ms->chans; i++ )
+  {
+    steps[i]  = _mm256_mullo_epi32( lane, _mm256_set1_epi32( ms->delta[i] ) );
+    rsteps[i] = _mm256_mullo_epi32( lane, _mm256_set1_epi32( ms->rdelta[i] ) );
+  }
+
+  for( n=0; n+8<=loops; n+=8 )
+  {
+    __m256i a = _mm256_setzero_si256();
+    __m256i b = _mm256_setzero_si256();
+
+    for( i=0; i<ms->chans; i++ )
     {
-      a=0;
-      b=0;
-      for( i=0; i<chans; i++ )
+      __m256i j = hvl_fetch8( ms->src[i], ms->pos[i], steps[i] );
+
+      if( ms->rsrc[i] )
       {
-        if( rsrc[i] )
-        {
-          /* Ring Modulation */
-          j = ((src[i][pos[i]>>16]*rsrc[i][rpos[i]>>16])>>7)*vol[i];
-          rpos[i] += rdelta[i];
-        } else {
-          j = src[i][pos[i]>>16]*vol[i];
-        }
+        /* Ring Modulation */
+        j = _mm256_srai_epi32( _mm256_mullo_epi32( j, hvl_fetch8( ms->rsrc[i], ms->rpos[i], rsteps[i] ) ), 7 );
+        ms->rpos[i] += ms->rdelta[i]*8;
+      }
+
+      j = _mm256_mullo_epi32( j, _mm256_set1_epi32( ms->vol[i] ) );
+      a = _mm256_add_epi32( a, _mm256_srai_epi32( _mm256_mullo_epi32( j, _mm256_set1_epi32( ms->panl[i] ) ), 7 ) );
+      b = _mm256_add_epi32( b, _mm256_srai_epi32( _mm256_mullo_epi32( j, _mm256_set1_epi32( ms->panr[i] ) ), 7 ) );
+      ms->pos[i] += ms->delta[i]*8;
+    }
+
+    a = _mm256_srai_epi32( _mm256_mullo_epi32( a, gain ), 8 );
+    b = _mm256_srai_epi32( _mm256_mullo_epi32( b, gain ), 8 );
 
-//        if( abs( j ) > vu[i] ) vu[i] = abs( j );
+    // packing and unpacking within each 128 bit lane leaves the samples
+    // in order
+    a = _mm256_packs_epi32( a, a );
+    b = _mm256_packs_epi32( b, b );
+    _mm256_storeu_si256( (__m256i *)&out[n*2], _mm256_unpacklo_epi16( a, b ) );
+  }
+
+  return n;
+}
+#endif
+
+static hvl_mixfunc mixfunc = NULL;
+
+static void hvl_SelectMixer( void )
+{
+#if defined(__SSE2__)
+  mixfunc = hvl_mix_sse2;
+#endif
+
+#ifdef HVL_MIX_AVX2
+  __builtin_cpu_init();
+
+  if( __builtin_cpu_supports( "avx2" ) )
+    mixfunc = hvl_mix_avx2;
+#endif
+}
+
+void hvl_mixchunk( struct hvl_tune *ht, uint32 samples, int8 *buf1, int8 *buf2, int32 bufmod )
+{
+  struct hvl_mixstate ms;
+  uint32  cnt, done;
+  uint32  i, loops;
+  BOOL    interleaved;
+
+  // the SIMD kernels only write interleaved stereo
+  interleaved = mixfunc && buf2 == buf1+2 && bufmod == 4;
+
+  ms.chans   = ht->ht_Channels;
+  ms.mixgain = ht->ht_mixgain;
+  for( i=0; i<ms.chans; i++ )
+  {
+    ms.delta[i] = ht->ht_Voices[i].vc_Delta;
+    ms.vol[i]   = ht->ht_Voices[i].vc_VoiceVolume;
+    ms.pos[i]   = ht->ht_Voices[i].vc_SamplePos;
+    ms.src[i]   = ht->ht_Voices[i].vc_MixSource;
+    ms.panl[i]  = ht->ht_Voices[i].vc_PanMultLeft;
+    ms.panr[i]  = ht->ht_Voices[i].vc_PanMultRight;
 
-        a += (j * panl[i]) >> 7;
-        b += (j * panr[i]) >> 7;
-        pos[i] += delta[i];
+    /* Ring Modulation */
+    ms.rdelta[i]= ht->ht_Voices[i].vc_RingDelta;
+    ms.rpos[i]  = ht->ht_Voices[i].vc_RingSamplePos;
+    ms.rsrc[i]  = ht->ht_Voices[i].vc_RingMixSource;
+  }
+
+  do
+  {
+    loops = samples;
+    for( i=0; i<ms.chans; i++ )
+    {
+      if( ms.pos[i] >= (0x280 << 16)) ms.pos[i] -= 0x280<<16;
+      cnt = ((0x280<<16) - ms.pos[i] - 1) / ms.delta[i] + 1;
+      if( cnt < loops ) loops = cnt;
+
+      if( ms.rsrc[i] )
+      {
+        if( ms.rpos[i] >= (0x280<<16)) ms.rpos[i] -= 0x280<<16;
+        cnt = ((0x280<<16) - ms.rpos[i] - 1) / ms.rdelta[i] + 1;
+        if( cnt < loops ) loops = cnt;
       }
 
-      a = (a*ht->ht_mixgain)>>8;
-      b = (b*ht->ht_mixgain)>>8;
+    }
 
-      // clamping
-      if (a<-0x8000) a=-0x8000;
-      if (a> 0x7fff) a= 0x7fff;
-      if (b<-0x8000) b=-0x8000;
-      if (b> 0x7fff) b= 0x7fff;
-      *(int16 *)buf1 = a;
-      *(int16 *)buf2 = b;
+    samples -= loops;
 
-      loops--;
+    done = interleaved ? mixfunc( &ms, loops, (int16 *)buf1 ) : 0;
+    buf1 += done * bufmod;
+    buf2 += done * bufmod;
 
+    // Inner loop, for what the kernel left
+    for( ; done<loops; done++ )
+    {
+      hvl_mix_sample( &ms, (int16 *)buf1, (int16 *)buf2 );
       buf1 += bufmod;
       buf2 += bufmod;
-    } while( loops > 0 );
+    }
   } while( samples > 0 );
 
-  for( i=0; i<chans; i++ )
+  for( i=0; i<ms.chans; i++ )
   {
-    ht->ht_Voices[i].vc_SamplePos = pos[i];
-    ht->ht_Voices[i].vc_RingSamplePos = rpos[i];
-//    ht->ht_Voices[i].vc_VUMeter = vu[i];
+    ht->ht_Voices[i].vc_SamplePos = ms.pos[i];
+    ht->ht_Voices[i].vc_RingSamplePos = ms.rpos[i];
   }
 }
 
@@ -228,6 +228,8 @@ struct hvl_tune
 };
 
 void hvl_DecodeFrame( struct hvl_tune *ht, int8 *buf1, int8 *buf2, int32 bufmod );
+uint32 hvl_ScanLength( struct hvl_tune *ht, uint32 maxsamples );
+uint32 hvl_Skip( struct hvl_tune *ht, uint32 samples );
 void hvl_InitReplayer( void );
 BOOL hvl_InitSubsong( struct hvl_tune *ht, uint32 nr );
 struct hvl_tune *hvl_LoadData( const uint8 *buf, uint32 buflen, uint32 freq, uint32 defstereo );
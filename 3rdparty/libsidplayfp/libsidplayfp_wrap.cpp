@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <iostream>
 
 // wrapper
@@ -13,42 +15,148 @@ void deleteSidConfig(SidConfig *c) {
     delete c;
 }
 
-ReSIDfpBuilder* newReSIDfpBuilder() {
+// Engines are handed out from a pool, with their builder configured for
+// one output format and emulation, and go back to it at unload. Creating
+// the builder and configuring the engine is most of what loading a tune
+// costs, so only the first load for a configuration pays for it. Only the
+// last few engines released are kept, so configurations no longer played
+// with, as the quality level moves on, are let go of.
+struct SidEnginePoolEntry {
+    sidplayfp* engine;
+    sidbuilder* builder;
+    unsigned int channels;
+    unsigned int samplerate;
+    SidEmulation emulation;
+    SidSampling sampling;
+    bool busy;
+};
+
+static std::mutex pool_mutex;
+// idle entries are kept in the order they were released
+static std::vector<SidEnginePoolEntry> pool;
+static const size_t pool_idle_max = 2;
+
+static void deleteSidEnginePoolEntry(SidEnginePoolEntry& e) {
+    // the engine uses the builder's emulations
+    delete e.engine;
+    delete e.builder;
+}
+
+bool hasSidEmulation(SidEmulation emulation) {
+#ifdef HAVE_SIDPLAYFP_BUILDERS_RESID_H
+    (void) emulation;
+    return true;
+#else
+    return emulation == SID_EMU_RESIDFP;
+#endif
+}
+
+static sidbuilder* newSidBuilder(SidEmulation emulation) {
+#ifdef HAVE_SIDPLAYFP_BUILDERS_RESID_H
+    if (emulation == SID_EMU_RESID)
+        return new ReSIDBuilder("modp_libsidplayfp_wrapper");
+#else
+    (void) emulation;
+#endif
     return new ReSIDfpBuilder("modp_libsidplayfp_wrapper");
 }
 
-void deleteReSIDfpBuilder(ReSIDfpBuilder *c) {
-    delete c;
-}
-
-sidplayfp* newSidEngine() {
-    return new sidplayfp();
-}
-
-void deleteSideEngine(sidplayfp *c) {
-    delete c;
-}
-
-unsigned int initSidEngine(sidplayfp *m_engine, ReSIDfpBuilder *rs, unsigned int channels, unsigned int samplerate) {
+static bool initSidEngine(sidplayfp *m_engine, sidbuilder *rs, unsigned int channels, unsigned int samplerate, SidSampling sampling) {
     SidConfig e_config;
     rs->create(m_engine->info().maxsids());
 
     if (!rs->getStatus()) {
         std::cerr << rs->error() << std::endl;
-        return 0;
+        return false;
     }
 
-    e_config.fastSampling = false;
+    // fast sampling trades aliasing for speed, resampling is the
+    // slowest and cleanest
+    e_config.fastSampling = (sampling == SID_SAMPLING_FAST);
     e_config.frequency = samplerate;
     e_config.playback = (channels == 1) ? SidConfig::MONO : SidConfig::STEREO;
-    e_config.samplingMethod = SidConfig::INTERPOLATE;
+    e_config.samplingMethod = (sampling == SID_SAMPLING_RESAMPLE)
+                              ? SidConfig::RESAMPLE_INTERPOLATE
+                              : SidConfig::INTERPOLATE;
     e_config.sidEmulation = rs;
 
     if (!m_engine->config(e_config)) {
         std::cerr << m_engine->error() << std::endl;
-        return 0;
+        return false;
     }
-    return 1;
+    return true;
+}
+
+sidplayfp* acquireSidEngine(unsigned int channels, unsigned int samplerate, SidEmulation emulation, SidSampling sampling) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    for (SidEnginePoolEntry& e : pool) {
+        if (!e.busy && e.channels == channels && e.samplerate == samplerate
+                && e.emulation == emulation && e.sampling == sampling) {
+            e.busy = true;
+            return e.engine;
+        }
+    }
+
+    if (!hasSidEmulation(emulation))
+        return nullptr;
+
+    SidEnginePoolEntry e = { new sidplayfp(), newSidBuilder(emulation),
+                             channels, samplerate, emulation, sampling, true };
+
+    if (!initSidEngine(e.engine, e.builder, channels, samplerate, sampling)) {
+        deleteSidEnginePoolEntry(e);
+        return nullptr;
+    }
+
+    pool.push_back(e);
+
+    return e.engine;
+}
+
+void releaseSidEngine(sidplayfp *m_engine) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    if (m_engine == nullptr)
+        return;
+
+    for (auto it = pool.begin(); it != pool.end(); ++it) {
+        if (it->engine == m_engine) {
+            SidEnginePoolEntry e = *it;
+
+            // the tune is deleted after this, the engine must not point at it
+            m_engine->load(nullptr);
+            e.busy = false;
+            pool.erase(it);
+            pool.push_back(e);
+            break;
+        }
+    }
+
+    size_t idle = 0;
+
+    for (const SidEnginePoolEntry& e : pool)
+        idle += !e.busy;
+
+    for (auto it = pool.begin(); idle > pool_idle_max; ) {
+        if (!it->busy) {
+            deleteSidEnginePoolEntry(*it);
+            it = pool.erase(it);
+            idle--;
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Deletes every engine in the pool, once none is in use any more.
+void freeSidEnginePool() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    for (SidEnginePoolEntry& e : pool)
+        deleteSidEnginePoolEntry(e);
+
+    pool.clear();
 }
 
 SidTune* newSidTune(const void *buf, unsigned int buflen) {
@@ -7,6 +7,9 @@
 #include <sidplayfp/SidTune.h>
 #include <sidplayfp/SidInfo.h>
 #include <sidplayfp/builders/residfp.h>
+#ifdef HAVE_SIDPLAYFP_BUILDERS_RESID_H
+#include <sidplayfp/builders/resid.h>
+#endif
 #include "sidplayfp/siddefs.h"
 #include <sidplayfp/SidTuneInfo.h>
 
@@ -21,15 +24,25 @@ typedef struct SidConfig SidConfig;
 typedef struct sidplayfp sidplayfp;
 typedef struct SidTune SidTune;
 
-struct ReSIDfpBuilder* newReSIDfpBuilder();
-void deleteReSIDfpBuilder(ReSIDfpBuilder *c);
+// without the reSID builder, only reSIDfp engines are made
+typedef enum SidEmulation {
+    SID_EMU_RESIDFP,
+    SID_EMU_RESID
+} SidEmulation;
+
+typedef enum SidSampling {
+    SID_SAMPLING_RESAMPLE,
+    SID_SAMPLING_INTERPOLATE,
+    SID_SAMPLING_FAST
+} SidSampling;
 
 struct SidConfig* newSidConfig();
 void deleteSidConfig(SidConfig *c);
 
-struct sidplayfp* newSidEngine();
-void deleteSideEngine(sidplayfp *c);
-unsigned int initSidEngine(sidplayfp *m_engine, ReSIDfpBuilder *rs, unsigned int channels, unsigned int samplerate);
+bool hasSidEmulation(SidEmulation emulation);
+struct sidplayfp* acquireSidEngine(unsigned int channels, unsigned int samplerate, SidEmulation emulation, SidSampling sampling);
+void releaseSidEngine(sidplayfp *m_engine);
+void freeSidEnginePool();
 bool isPlayingSidEngine(sidplayfp *m_engine);
 
 struct SidTune* newSidTune(const void *buf, unsigned int buflen);
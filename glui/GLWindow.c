@@ -20,6 +20,9 @@
 #include "Player.h"
 #include "Globals.h"
 
+// the playback tap is float, the scales below were made for int16
+#define VIS_S16_SCALE 32768.f
+
 static void
 GLUI_DrawStars(GLWindow_State* wdw, bool in_front)
 {
@@ -80,7 +83,7 @@ GLUI_DrawVis(GLWindow_State* wdw)
 	Player_GetPlaybackData(wdw->ps, v->vis_buf, v->vis_len, true);
 
 	for (size_t i = 0; i < v->nsamples * 2; i += 2)
-		v->signal[i / 2] = (v->vis_buf[i] + v->vis_buf[i + 1]) / 2.f * v->window[i / 2];
+		v->signal[i / 2] = (v->vis_buf[i] + v->vis_buf[i + 1]) / 2.f * v->window[i / 2] * VIS_S16_SCALE;
 
 	fftwf_execute(v->plan);
 
@@ -117,7 +120,7 @@ GLUI_DrawVis(GLWindow_State* wdw)
 		glEnd();
 	}
 
-	scale = 192.f;
+	scale = 192.f / VIS_S16_SCALE;
 	if (wdw->vis == VIS_SCOPE && wdw->ps->am->playing) {
 		glBindTexture(GL_TEXTURE_2D, 0);
 		GL_OrthoOn(wdw->width, wdw->height);
@@ -181,6 +184,7 @@ GLUI_DrawVis(GLWindow_State* wdw)
 static void
 GLUI_DrawSongInfo(GLWindow_State* wdw, int y, int title_zoom, int info_zoom)
 {
+	AudioManager_NowPlaying now;
 	const char* title;
 	const char* info;
 	char tmp[MODP_STR_LENGTH];
@@ -188,8 +192,9 @@ GLUI_DrawSongInfo(GLWindow_State* wdw, int y, int title_zoom, int info_zoom)
 
 	Font_DrawString(wdw, "\\ccccccff", 0, 0, 0);
 
-	title = AudioRenderer_Title(wdw->ps->am->active_ar);
-	info = AudioRenderer_Info(wdw->ps->am->active_ar);
+	AudioManager_GetNowPlaying(wdw->ps->am, &now);
+	title = now.loaded ? now.title : NULL;
+	info = now.loaded ? now.info : NULL;
 
 	if (info != NULL)
 		Font_DrawString(wdw, info, 0, y - (wdw->font->font_height * (title_zoom + info_zoom)), info_zoom);
@@ -207,13 +212,13 @@ GLUI_DrawSongInfo(GLWindow_State* wdw, int y, int title_zoom, int info_zoom)
 		Font_DrawString(wdw, tmp, 0, y - (wdw->font->font_height * title_zoom), title_zoom);
 	}
 
-	ntracks = AudioRenderer_NTracks(wdw->ps->am->active_ar);
+	ntracks = now.ntracks;
 
 	if (ntracks > 1) {
 		assert(snprintf(tmp,
 		                MODP_STR_LENGTH,
 		                "\\ffffff80[%.2d/%.2d]",
-		                AudioRenderer_Track(wdw->ps->am->active_ar) + 1,
+		                now.track + 1,
 		                ntracks) < MODP_STR_LENGTH - 1);
 
 		title_zoom = 2;
@@ -227,9 +232,12 @@ void
 GLUI_Draw(GLWindow_State* wdw)
 {
 	char tmp_str[MODP_STR_LENGTH];
+	AudioManager_NowPlaying now;
+
+	AudioManager_GetNowPlaying(wdw->ps->am, &now);
 
-	float song_pos = AudioRenderer_PlayTime(wdw->ps->am->active_ar);
-	float song_len = AudioRenderer_Length(wdw->ps->am->active_ar);
+	float song_pos = now.play_time;
+	float song_len = now.length;
 
 	int x = (int) ((float) wdw->width * 0.6f / wdw->font->font_width) * wdw->font->font_width;
 	int y = wdw->height / 2 + (wdw->max_items * (wdw->font->font_height));
@@ -249,11 +257,16 @@ GLUI_Draw(GLWindow_State* wdw)
 	                zoom);
 
 	for (size_t i = 0; i < wdw->max_items; i++) {
-		bool isdir;
+		bool isdir = false;
 		const char* name = Directory_GetName(wdw->ps->dir,
 		                                     i + wdw->ps->dir_ofs,
 		                                     &isdir);
 
+		// shows where the listing ends while the directory is read
+		if (name == NULL && wdw->ps->dir_scanning
+		        && i + wdw->ps->dir_ofs == Directory_NTotal(wdw->ps->dir))
+			name = "\\777777ff...";
+
 		assert(snprintf(tmp_str,
 		                MODP_STR_LENGTH,
 		                "%s%s",
@@ -335,6 +348,14 @@ GLWindow_HandleKeyDown(GLWindow_State* wdw, SDL_Keysym* keysym)
 		case SDLK_LEFT:
 			Player_AlterSubTrack(wdw->ps, -1);
 			break;
+		case SDLK_PERIOD:
+			Player_Seek(wdw->ps, keysym->mod & KMOD_SHIFT
+			                     ? MODP_SEEK_LONG_MS : MODP_SEEK_MS);
+			break;
+		case SDLK_COMMA:
+			Player_Seek(wdw->ps, keysym->mod & KMOD_SHIFT
+			                     ? -MODP_SEEK_LONG_MS : -MODP_SEEK_MS);
+			break;
 		case SDLK_PAGEDOWN:
 			Player_AlterOffset(wdw->ps, wdw->max_items);
 			break;
@@ -436,7 +457,7 @@ Vis_Init(size_t wdw_width, size_t wdw_height, size_t nsamples, size_t nstars)
 	v->nsamples = nsamples;
 
 	v->vis_len = wdw_width * 2;
-	v->vis_buf = (T*) calloc(v->vis_len, sizeof(T));
+	v->vis_buf = (float*) calloc(v->vis_len, sizeof(float));
 	assert(v->vis_buf);
 
 	v->window = (float*) calloc(v->fft_len, sizeof(float));
@@ -30,6 +30,20 @@ typedef struct Options {
 	float clr_r;
 	float clr_g;
 	float clr_b;
+	char render_path[_TINYDIR_PATH_MAX];
+	char out_path[_TINYDIR_PATH_MAX];
+	size_t render_sec;
+	char output[_TINYDIR_PATH_MAX];
+	int fs;
+	int channels;
+	int bits;
+	int render_fs;
+	int rs_quality;
+	float silence_db;
+	float silence_hyst_db;
+	int silence_ms;
+	char songlengths_path[_TINYDIR_PATH_MAX];
+	int sid_mode;
 } Options;
 
 typedef struct Star {
@@ -43,7 +57,7 @@ typedef struct Star {
 } Star;
 
 struct Vis_State {
-	T* vis_buf;
+	float* vis_buf;
 	size_t vis_len;
 
 	Star* stars;
@@ -11,6 +11,11 @@
 #include "GLWindow.h"
 
 #include "Player.h"
+#include "LocalDir.h"
+#include "Sample.h"
+#include "Resampler.h"
+#include "SIDRenderer.h"
+#include "SongLengths.h"
 #include "Globals.h"
 #include "MinMax.h"
 
@@ -22,7 +27,8 @@ void
 Usage(Options* o, const char* name)
 {
 	fprintf(stdout,
-	        "\n%s [OPTIONS]\n\n"
+	        "\n%s [OPTIONS]\n"
+	        "%s --render FILE -o OUT.wav [-t SECONDS]\n\n"
 	        "-p    Initial path, default is \"%s\"\n"
 	        "-f    Path to a BDF font, default is an internal font\n"
 	        "-v    Pixel-double font vertically, default is %u\n"
@@ -34,9 +40,25 @@ Usage(Options* o, const char* name)
 	        "-l    Framerate limit, default is %.2f\n"
 	        "-r    Background color red component, default is %.2f\n"
 	        "-g    Background color green component, default is %.2f\n"
-	        "-b    Background color blue component, default is %.2f\n\n"
+	        "-b    Background color blue component, default is %.2f\n"
+	        "-d    Audio output, portaudio, alsa[:DEVICE], null, wav:PATH or\n"
+	        "      raw:PATH, default is %s\n"
+	        "-s    Sample rate, default is %d\n"
+	        "-c    Channels, 1 or 2, default is %d\n"
+	        "-x    Sample format, s16 or f32, default is %s\n"
+	        "-i    Rate the backends render at, resampled to -s, default is\n"
+	        "      the output rate\n"
+	        "-q    Resampler quality, fast, good or best, default is %s\n"
+	        "-z    Silence threshold dBFS, hysteresis dB and minimum ms,\n"
+	        "      default is %.0f,%.0f,%d\n"
+	        "-k    Path to the HVSC Songlengths.md5, default is none\n"
+	        "-j    SID emulation, residfp-resample, residfp, residfp-fast,\n"
+	        "      resid, resid-fast or auto, default is %s\n\n"
+	        "-o    Output file for --render\n"
+	        "-t    Maximum --render length in seconds, default is %" PRIu64 "\n\n"
 	        "-h    Show default command line options\n\n",
 	        name,
+	        name,
 	        o->path,
 	        o->font_dbl,
 	        o->auto_inc,
@@ -47,14 +69,30 @@ Usage(Options* o, const char* name)
 	        o->fps_limit,
 	        o->clr_r,
 	        o->clr_g,
-	        o->clr_b);
+	        o->clr_b,
+	        o->output,
+	        o->fs,
+	        o->channels,
+	        o->bits == SAMPLE_F32 ? "f32" : "s16",
+	        Resampler_QualityName(o->rs_quality),
+	        o->silence_db,
+	        o->silence_hyst_db,
+	        o->silence_ms,
+	        SIDRenderer_ModeName(o->sid_mode),
+	        o->render_sec);
 }
 
 void
 ParseOptions(Options* o, int argc, char* argv[])
 {
 	int c, tmp;
-	while ((c = getopt(argc, argv, "p:f:v:a:n:m:w:e:l:r:g:b:")) != -1) {
+
+	if (argc > 2 && strcmp(argv[1], "--render") == 0) {
+		strcpy(o->render_path, argv[2]);
+		optind = 3;
+	}
+
+	while ((c = getopt(argc, argv, "p:f:v:a:n:m:w:e:l:r:g:b:d:s:c:x:i:q:z:k:j:o:t:")) != -1) {
 		switch (c) {
 			case 'p':
 				strcpy(o->path, optarg);
@@ -105,10 +143,64 @@ ParseOptions(Options* o, int argc, char* argv[])
 				if (sscanf(optarg, "%f", &o->clr_b) != 1) goto error;
 				o->clr_b = min_float(max_float(o->clr_b, 0.f), 1.f);
 				break;
+			case 'd':
+				strcpy(o->output, optarg);
+				break;
+			case 's':
+				if (sscanf(optarg, "%d", &tmp) != 1) goto error;
+				if (tmp < SAMPLE_MIN_FS || tmp > SAMPLE_MAX_FS) goto error;
+				o->fs = tmp;
+				break;
+			case 'c':
+				if (sscanf(optarg, "%d", &tmp) != 1) goto error;
+				if (tmp < 1 || tmp > SAMPLE_MAX_CH) goto error;
+				o->channels = tmp;
+				break;
+			case 'x':
+				if (strcmp(optarg, "s16") == 0)
+					o->bits = SAMPLE_S16;
+				else if (strcmp(optarg, "f32") == 0)
+					o->bits = SAMPLE_F32;
+				else
+					goto error;
+				break;
+			case 'i':
+				if (sscanf(optarg, "%d", &tmp) != 1) goto error;
+				if (tmp < SAMPLE_MIN_FS || tmp > SAMPLE_MAX_FS) goto error;
+				o->render_fs = tmp;
+				break;
+			case 'q':
+				o->rs_quality = Resampler_ParseQuality(optarg);
+				if (o->rs_quality < 0) goto error;
+				break;
+			case 'z':
+				if (sscanf(optarg, "%f,%f,%d", &o->silence_db,
+				           &o->silence_hyst_db, &o->silence_ms) != 3)
+					goto error;
+				if (o->silence_db >= 0.f || o->silence_hyst_db < 0.f
+				        || o->silence_ms < 0) goto error;
+				break;
+			case 'k':
+				strcpy(o->songlengths_path, optarg);
+				break;
+			case 'j':
+				o->sid_mode = SIDRenderer_ParseMode(optarg);
+				if (o->sid_mode < 0) goto error;
+				break;
+			case 'o':
+				strcpy(o->out_path, optarg);
+				break;
+			case 't':
+				if (sscanf(optarg, "%d", &tmp) != 1 || tmp <= 0) goto error;
+				o->render_sec = (size_t) tmp;
+				break;
 			default:
 				goto error;
 		}
 	}
+	if (*o->render_path && !*o->out_path)
+		goto error;
+
 	return;
 error:
 	Usage(o, argv[0]);
@@ -128,6 +220,57 @@ CheckOptions(int argc, char* argv[])
 	return 0;
 }
 
+void
+PrintResamplerStats(AudioManager* am)
+{
+	AudioManager_ResamplerStats rs_stats;
+
+	if (AudioManager_GetResamplerStats(am, &rs_stats))
+		fprintf(stdout, "resampler: %d to %d Hz, %s, %s, %.2f ms per second\n",
+		        rs_stats.in_fs, rs_stats.out_fs, rs_stats.quality,
+		        rs_stats.isa, rs_stats.cost * 1e3);
+}
+
+int
+RenderMain(Options* o)
+{
+	AudioManager* am;
+	AudioManager_RenderStats stats;
+	void* data;
+	size_t len;
+	int r;
+
+	data = LocalDir_MapFile(o->render_path, &len, MODP_MAX_FILESIZE);
+
+	if (data == NULL) {
+		fprintf(stderr, "%s: could not read file\n", o->render_path);
+		return 1;
+	}
+
+	am = AudioManager_CreateOffline(o->fs, o->bits, o->channels,
+	                                o->render_fs, o->rs_quality);
+
+	if (am == NULL) {
+		LocalDir_UnmapFile(data, len);
+		return 1;
+	}
+
+	r = AudioManager_RenderToFile(am, o->render_path, data, len,
+	                              o->out_path, o->render_sec, &stats);
+
+	if (r == 0)
+		fprintf(stdout, "%s: rendered %.2f s in %.3f s, %.1fx realtime\n",
+		        o->out_path, stats.seconds, stats.elapsed,
+		        stats.elapsed > 0 ? stats.seconds / stats.elapsed : 0);
+
+	PrintResamplerStats(am);
+
+	AudioManager_Destroy(am);
+	LocalDir_UnmapFile(data, len);
+
+	return r;
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -135,6 +278,8 @@ main(int argc, char* argv[])
 	Player_State* ps = NULL;
 	bool running = true;
 	Uint32 t_prev = 0;
+	AudioManager_OutputStats out_stats;
+	SongLengths* songlengths = NULL;
 
 	Options opt = { .path = ".",
 	                .fontpath = "",
@@ -147,7 +292,21 @@ main(int argc, char* argv[])
 	                .fps_limit = 60.f,
 	                .clr_r = 0.0f,
 	                .clr_g = 0.33f,
-	                .clr_b = 0.67f };
+	                .clr_b = 0.67f,
+	                .render_path = "",
+	                .out_path = "",
+	                .render_sec = 600,
+	                .output = "portaudio",
+	                .fs = 48000,
+	                .channels = 2,
+	                .bits = SAMPLE_S16,
+	                .render_fs = 0,
+	                .rs_quality = RSQ_GOOD,
+	                .silence_db = MODP_SILENCE_DB,
+	                .silence_hyst_db = MODP_SILENCE_HYST_DB,
+	                .silence_ms = MODP_MAX_SILENCE_MS,
+	                .songlengths_path = "",
+	                .sid_mode = SIDM_AUTO };
 
 	if (CheckOptions(argc, argv)) {
 		Usage(&opt, argv[0]);
@@ -155,10 +314,41 @@ main(int argc, char* argv[])
 	}
 
 	ParseOptions(&opt, argc, argv);
+	SIDRenderer_SetMode(opt.sid_mode);
 
-	ps = Player_Init(48e3, 16, 2, opt.min_length,
+	if (*opt.songlengths_path) {
+		songlengths = SongLengths_Open(opt.songlengths_path);
+
+		if (songlengths == NULL)
+			fprintf(stderr, "%s: could not read song lengths\n",
+			        opt.songlengths_path);
+
+		SIDRenderer_SetSongLengths(songlengths);
+	}
+
+	if (*opt.render_path) {
+		int r = RenderMain(&opt);
+
+		SongLengths_Close(songlengths);
+
+		return r;
+	}
+
+	ps = Player_Init(opt.fs, opt.bits, opt.channels, opt.render_fs,
+	                 opt.rs_quality, opt.output, opt.min_length,
 	                 opt.auto_inc, opt.auto_rnd, opt.path);
-	assert(ps);
+
+	if (ps == NULL) {
+		SongLengths_Close(songlengths);
+		return 1;
+	}
+
+	AudioManager_SetSilence(ps->am, opt.silence_db, opt.silence_hyst_db,
+	                        opt.silence_ms);
+
+	AudioManager_GetOutputStats(ps->am, &out_stats);
+	fprintf(stdout, "output: %s, latency %.1f ms\n",
+	        out_stats.name, out_stats.latency * 1e3);
 
 	wdw = GLWindow_Init(&opt, ps);
 	assert(wdw);
@@ -171,6 +361,7 @@ main(int argc, char* argv[])
 		Uint32 t_now;
 
 		running = GLWindow_ProcessEvents(wdw, &got_input);
+		Player_UpdateDir(wdw->ps);
 		Player_UpdateAutoInc(wdw->ps, got_input);
 		GL_Clear();
 		GLUI_Draw(wdw);
@@ -186,8 +377,14 @@ main(int argc, char* argv[])
 		t_prev = SDL_GetTicks();
 	}
 
+	AudioManager_GetOutputStats(ps->am, &out_stats);
+	fprintf(stdout, "output: %s, %u underruns, %u device xruns\n",
+	        out_stats.name, out_stats.underruns, out_stats.xruns);
+	PrintResamplerStats(ps->am);
+
 	Player_Destroy(wdw->ps);
 	GLWindow_Destroy(wdw);
+	SongLengths_Close(songlengths);
 
 	return 0;
 }
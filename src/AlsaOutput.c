@@ -0,0 +1,259 @@
+// Copyright intealls
+// License: GPL v3
+#ifdef HAVE_LIBASOUND
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <alsa/asoundlib.h>
+#include <SDL2/SDL_thread.h>
+
+#include "AlsaOutput.h"
+#include "Sample.h"
+#include "Globals.h"
+
+typedef struct AlsaOutput_Data {
+	snd_pcm_t* pcm;
+	snd_pcm_uframes_t buffer_size,
+	                  period_size;
+	void* period;
+
+	SDL_Thread* thread;
+	_Atomic bool running;
+
+	AudioOutput_Callback cb;
+	void* user;
+	_Atomic unsigned int xruns;
+	int fs, bits, channels;
+} AlsaOutput_Data;
+
+#define DataObject(a, b) \
+	AlsaOutput_Data* (a) = (AlsaOutput_Data*) (b)->data; \
+	assert((a)); \
+	DebugPrint((b));
+
+static int
+AlsaOutput_Thread(void* data)
+{
+	AlsaOutput_Data* out_data = (AlsaOutput_Data*) data;
+	size_t frame_size = out_data->channels * out_data->bits / 8;
+
+	while (atomic_load(&out_data->running)) {
+		snd_pcm_uframes_t written = 0;
+
+		out_data->cb(out_data->period, out_data->period_size, out_data->user);
+
+		while (written < out_data->period_size) {
+			snd_pcm_sframes_t r;
+
+			r = snd_pcm_writei(out_data->pcm,
+			                   (char*) out_data->period + written * frame_size,
+			                   out_data->period_size - written);
+
+			if (r < 0) {
+				if (r == -EPIPE)
+					atomic_fetch_add(&out_data->xruns, 1);
+
+				r = snd_pcm_recover(out_data->pcm, r, 1);
+
+				if (r < 0) {
+					fprintf(stderr, "AlsaOutput: %s\n", snd_strerror(r));
+					atomic_store(&out_data->running, false);
+					break;
+				}
+
+				continue;
+			}
+
+			written += r;
+		}
+	}
+
+	return 0;
+}
+
+static int
+AlsaOutput_Start(const AudioOutput* obj)
+{
+	int status;
+
+	DataObject(out_data, obj);
+
+	if (out_data->thread != NULL) {
+		if (atomic_load(&out_data->running))
+			return 0;
+
+		// the writer gave up on an error it could not recover from, the
+		// device is set up again and a new one started
+		SDL_WaitThread(out_data->thread, &status);
+		out_data->thread = NULL;
+		snd_pcm_drop(out_data->pcm);
+	}
+
+	if (snd_pcm_prepare(out_data->pcm) < 0)
+		return 1;
+
+	atomic_store(&out_data->running, true);
+
+	out_data->thread = SDL_CreateThread(AlsaOutput_Thread,
+	                                    NULL,
+	                                    (void*) out_data);
+	assert(out_data->thread);
+
+	return 0;
+}
+
+static int
+AlsaOutput_Stop(const AudioOutput* obj)
+{
+	int status;
+
+	DataObject(out_data, obj);
+
+	if (out_data->thread == NULL)
+		return 0;
+
+	atomic_store(&out_data->running, false);
+	SDL_WaitThread(out_data->thread, &status);
+	out_data->thread = NULL;
+
+	// drop rather than drain, pausing should be immediate
+	snd_pcm_drop(out_data->pcm);
+
+	return 0;
+}
+
+static bool
+AlsaOutput_Active(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	return out_data->thread != NULL && atomic_load(&out_data->running);
+}
+
+static double
+AlsaOutput_Latency(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	// the device buffer is kept full, so a pulled period waits behind it
+	return (double) out_data->buffer_size / out_data->fs;
+}
+
+static unsigned int
+AlsaOutput_XRuns(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	return atomic_load(&out_data->xruns);
+}
+
+static const char*
+AlsaOutput_Name(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return "alsa";
+}
+
+static void
+AlsaOutput_Destroy(AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	AlsaOutput_Stop(obj);
+
+	snd_pcm_close(out_data->pcm);
+
+	free(out_data->period);
+	free(out_data);
+	free(obj);
+}
+
+AudioOutput*
+AlsaOutput_Create(const char* device, int fs, int bits, int channels,
+                  AudioOutput_Callback cb, void* user)
+{
+	AudioOutput* aout;
+	AlsaOutput_Data* out_data;
+	unsigned int latency_us;
+	int err;
+	static AudioOutput_VTable _vtable;
+	static bool _initialized = false;
+
+	if (!_initialized) {
+		memset((void*) &_vtable, 0, sizeof(AudioOutput_VTable));
+
+		_vtable.Start   = (*AlsaOutput_Start);
+		_vtable.Stop    = (*AlsaOutput_Stop);
+		_vtable.Active  = (*AlsaOutput_Active);
+		_vtable.Latency = (*AlsaOutput_Latency);
+		_vtable.XRuns   = (*AlsaOutput_XRuns);
+		_vtable.Name    = (*AlsaOutput_Name);
+		_vtable.Destroy = (*AlsaOutput_Destroy);
+
+		_initialized = true;
+	}
+
+	if (device == NULL || *device == '\0')
+		device = "default";
+
+	out_data = (AlsaOutput_Data*) calloc(1, sizeof(AlsaOutput_Data));
+	assert(out_data);
+
+	out_data->cb = cb;
+	out_data->user = user;
+	out_data->fs = fs;
+	out_data->bits = bits;
+	out_data->channels = channels;
+	atomic_init(&out_data->running, false);
+	atomic_init(&out_data->xruns, 0);
+
+	err = snd_pcm_open(&out_data->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+
+	if (err < 0) {
+		fprintf(stderr, "AlsaOutput: %s: %s\n", device, snd_strerror(err));
+		free(out_data);
+		return NULL;
+	}
+
+	// ask for two periods of the size PortAudio is opened with, the
+	// device may grant something else, so the actual sizes are read back
+	latency_us = (unsigned int) (2ULL * MODP_OUT_FRAMES * 1000000 / fs);
+
+	err = snd_pcm_set_params(out_data->pcm,
+	                         bits == SAMPLE_F32 ? SND_PCM_FORMAT_FLOAT
+	                                            : SND_PCM_FORMAT_S16,
+	                         SND_PCM_ACCESS_RW_INTERLEAVED,
+	                         channels,
+	                         fs,
+	                         1,
+	                         latency_us);
+
+	if (err >= 0)
+		err = snd_pcm_get_params(out_data->pcm,
+		                         &out_data->buffer_size,
+		                         &out_data->period_size);
+
+	if (err < 0) {
+		fprintf(stderr, "AlsaOutput: %s: %s\n", device, snd_strerror(err));
+		snd_pcm_close(out_data->pcm);
+		free(out_data);
+		return NULL;
+	}
+
+	out_data->period = calloc(out_data->period_size, channels * bits / 8);
+	assert(out_data->period);
+
+	aout = (AudioOutput*) calloc(1, sizeof(AudioOutput));
+	assert(aout);
+
+	aout->vtable = &_vtable;
+	aout->data = (void*) out_data;
+
+	return aout;
+}
+#endif
@@ -0,0 +1,13 @@
+// Copyright intealls
+// License: GPL v3
+#ifdef HAVE_LIBASOUND
+#ifndef ALSAOUTPUT_H_
+#define ALSAOUTPUT_H_
+
+#include "AudioOutput.h"
+
+AudioOutput* AlsaOutput_Create(const char*, int, int, int,
+                               AudioOutput_Callback, void*);
+
+#endif /* ALSAOUTPUT_H_ */
+#endif
@@ -2,8 +2,9 @@
 // License: GPL v3
 
 #include <stdio.h>
+#include <strings.h>
 
-#include <portaudio.h>
+#include <SDL2/SDL_timer.h>
 
 #include "AudioManager.h"
 #include "XMPRenderer.h"
@@ -13,115 +14,314 @@
 #include "GMERenderer.h"
 #include "HVLRenderer.h"
 #include "SIDRenderer.h"
+#include "WavFile.h"
+#include "PortAudioOutput.h"
+#ifdef HAVE_LIBASOUND
+#include "AlsaOutput.h"
+#endif
+#include "FileOutput.h"
+#include "Sample.h"
+#include "Resampler.h"
 
 void
 AudioManager_PlayPause(AudioManager* am)
 {
-	PaError active, stopped;
 	assert(am);
 
-	if (!AudioRenderer_Loaded(am->active_ar))
+	if (!AudioManager_Loaded(am))
 		return;
 
-	active = Pa_IsStreamActive(am->stream);
-	stopped = Pa_IsStreamStopped(am->stream);
-
-	assert(active >= paNoError);
-	assert(stopped >= paNoError);
-
-	if (active) {
-		am->pa_err = Pa_AbortStream(am->stream);
+	if (AudioOutput_Active(am->out)) {
+		AudioOutput_Stop(am->out);
 		am->playing = false;
 		//atomic_store(&am->cb_msg, CBM_CLR_BUF);
-	} else if (stopped) {
-		am->pa_err = Pa_StartStream(am->stream);
+	} else {
+		AudioOutput_Start(am->out);
 		am->playing = true;
 	}
 }
 
+static AudioRenderer_Confidence
+AudioManager_Sniff(AudioRenderer* ar,
+                   const char* ext,
+                   const void* data,
+                   size_t len)
+{
+	const AudioRenderer_Sig* sig = AudioRenderer_Sigs(ar);
+	AudioRenderer_Confidence conf = ARC_NONE;
+	bool ext_match = false;
+
+	for (; sig->magic != NULL || sig->ext != NULL; sig++) {
+		if (sig->magic != NULL) {
+			if (sig->ofs + sig->len <= len && sig->conf > conf
+			        && !memcmp((const char*) data + sig->ofs,
+			                   sig->magic, sig->len))
+				conf = sig->conf;
+		} else if (ext != NULL && !strcasecmp(ext, sig->ext)) {
+			ext_match = true;
+		}
+	}
+
+	if (ext_match)
+		conf = conf == ARC_WEAK ? ARC_CERTAIN : conf > ARC_EXT ? conf : ARC_EXT;
+
+	return conf;
+}
+
+// Picks the renderer for a file from the signature tables, and only probes
+// with CanLoad when no signature is certain, most likely renderers first
+// and then the rest in order. Returns the index in ars, or -1, and what
+// the probe prepared for Load in prepared.
+static int
+AudioManager_Resolve(AudioRenderer** ars,
+                     const char* filename,
+                     const void* data,
+                     size_t len,
+                     void** prepared)
+{
+	AudioRenderer_Confidence conf[AM_MAX_RENDERERS];
+	const char* ext = NULL;
+	int best = -1;
+
+	*prepared = NULL;
+
+	if (filename != NULL && (ext = strrchr(filename, '.')) != NULL)
+		ext++;
+
+	for (int i = 0; ars[i] != NULL; i++) {
+		assert(i < AM_MAX_RENDERERS);
+
+		conf[i] = AudioManager_Sniff(ars[i], ext, data, len);
+
+		if (best < 0 || conf[i] > conf[best])
+			best = i;
+	}
+
+	if (best >= 0 && conf[best] == ARC_CERTAIN)
+		return best;
+
+	for (int c = ARC_WEAK; c >= ARC_NONE; c--) {
+		for (int i = 0; ars[i] != NULL; i++) {
+			if ((int) conf[i] == c
+			        && AudioRenderer_CanLoad(ars[i], data, len, prepared))
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+// The renderer for a file, or NULL. prepared is to be passed on to
+// AudioManager_Load with it.
 AudioRenderer*
 AudioManager_CanLoad(AudioManager* am,
+                     const char* filename,
                      void* data,
-                     size_t len)
+                     size_t len,
+                     void** prepared)
 {
+	int idx;
+
 	assert(am);
+	assert(prepared);
 
-	AudioRenderer** p;
-	AudioRenderer* rend = NULL;
+	// the probing set is never loaded or rendered, so this needs no lock
+	idx = AudioManager_Resolve(am->ars, filename, data, len, prepared);
 
-	SDL_LockMutex(am->mutex);
+	return idx >= 0 ? am->ars[idx] : NULL;
+}
 
-	p = am->ars;
+static int
+AudioManager_RendererIdx(AudioManager* am,
+                         AudioRenderer* rend)
+{
+	for (int i = 0; am->ars[i] != NULL; i++) {
+		if (am->ars[i] == rend)
+			return i;
+	}
 
-	while (*p != NULL) {
-		if (AudioRenderer_CanLoad(*p, data, len)) {
-			rend = *p;
-			break;
-		}
+	return -1;
+}
 
-		p++;
+static int
+AudioManager_FreeSlot(AudioManager* am)
+{
+	int active = AM_SLOT(atomic_load(&am->active));
+	int rendering = atomic_load(&am->rendering);
+	int next = atomic_load(&am->next);
+
+	// the render thread only ever takes the active or the next slot, and
+	// next is cleared while preloading, so there is always a free one
+	for (int i = 0; i < MODP_AM_SLOTS; i++) {
+		if (i != active && i != rendering && i != next
+		        && i != am->preloading)
+			return i;
 	}
 
-	SDL_UnlockMutex(am->mutex);
+	assert(false);
 
-	return rend;
+	return -1;
 }
 
-static bool
-AudioManager_TryLoad(AudioManager* am,
-                     AudioRenderer* rend,
-                     const char* filename,
-                     void* data,
-                     size_t len)
+// Takes down what the UI is shown of ar, NULL for nothing, as what the
+// active word v plays. now_mutex is to be held.
+static void
+AudioManager_Describe(AudioManager* am,
+                      AudioRenderer* ar,
+                      unsigned int v)
 {
-	assert(am);
+	AudioManager_NowPlaying* now = &am->now;
+	const char* s;
 
-	if (!AudioRenderer_Load(rend, filename, data, len)) {
-		am->pa_err = Pa_StartStream(am->stream);
-		am->playing = true;
-		am->active_ar = rend;
-		atomic_store(&am->cb_msg, CBM_CLR_BUF);
+	now->active = v;
+	now->loaded = ar != NULL && AudioRenderer_Loaded(ar);
 
-		return 0;
+	if (!now->loaded) {
+		now->title[0] = now->info[0] = '\0';
+		now->track = -1;
+		now->ntracks = now->play_time = now->length = 0;
+		return;
 	}
 
-	am->pa_err = Pa_StopStream(am->stream);
-	am->playing = false;
+	s = AudioRenderer_Title(ar);
+	snprintf(now->title, MODP_STR_LENGTH, "%s", s != NULL ? s : "");
+	s = AudioRenderer_Info(ar);
+	snprintf(now->info, MODP_STR_LENGTH, "%s", s != NULL ? s : "");
 
-	return 1;
+	now->track = AudioRenderer_Track(ar);
+	now->ntracks = AudioRenderer_NTracks(ar);
+	now->play_time = AudioRenderer_PlayTime(ar);
+	now->length = AudioRenderer_Length(ar);
 }
 
+// Updates what the UI is shown from the renderer the render thread plays
+// for the active word v, unless another one was published meanwhile.
+static void
+AudioManager_UpdateNow(AudioManager* am,
+                       AudioRenderer* ar,
+                       unsigned int v)
+{
+	SDL_LockMutex(am->now_mutex);
+
+	if (am->now.active == v)
+		AudioManager_Describe(am, ar, v);
+
+	SDL_UnlockMutex(am->now_mutex);
+}
+
+// Publishes slot, whose renderer the calling thread owns until then.
+static void
+AudioManager_Publish(AudioManager* am,
+                     int slot)
+{
+	unsigned int v = atomic_load(&am->active);
+
+	v = ((AM_GEN(v) + 1) << 8) | slot;
+
+	atomic_store(&am->track_req, -1);
+	atomic_store(&am->seek_req, -1);
+
+	SDL_LockMutex(am->now_mutex);
+	AudioManager_Describe(am, slot == AM_SLOT_NONE ? NULL : am->slots[slot].ar,
+	                      v);
+	SDL_UnlockMutex(am->now_mutex);
+
+	atomic_store(&am->active, v);
+}
+
+static void
+AudioManager_UnLoadStale(AudioManager* am)
+{
+	int active = AM_SLOT(atomic_load(&am->active));
+	int rendering = atomic_load(&am->rendering);
+	int next = atomic_load(&am->next);
+
+	// a slot the render thread is still finishing is left for a later call
+	for (int i = 0; i < MODP_AM_SLOTS; i++) {
+		if (i != active && i != rendering && i != next
+		        && am->slots[i].ar != NULL) {
+			AudioRenderer_UnLoad(am->slots[i].ar);
+			am->slots[i].ar = NULL;
+		}
+	}
+}
+
+// Loads into the instances of a slot that is neither published nor being
+// rendered, trying renderer idx first, with what its probe prepared, and
+// then the others.
+static AudioRenderer*
+AudioManager_LoadSlot(AudioManager* am,
+                      int slot,
+                      int idx,
+                      void* prepared,
+                      const char* filename,
+                      void* data,
+                      size_t len)
+{
+	AudioRenderer** p = am->slots[slot].ars;
+
+	assert(idx >= 0 || prepared == NULL);
+
+	if (idx >= 0
+	        && !AudioRenderer_Load(p[idx], filename, data, len, prepared))
+		return p[idx];
+
+	for (int i = 0; p[i] != NULL; i++) {
+		if (i != idx && !AudioRenderer_Load(p[i], filename, data, len, NULL))
+			return p[i];
+	}
+
+	return NULL;
+}
+
+// Loads and plays a file, with rend and prepared as AudioManager_CanLoad
+// returned them. prepared is used up either way.
 int
 AudioManager_Load(AudioManager* am,
                   AudioRenderer* rend,
+                  void* prepared,
                   const char* filename,
                   void* data,
                   size_t len)
 {
 	int r = 1;
+	int slot;
 	assert(am);
 
-	AudioRenderer** p;
-
 	SDL_LockMutex(am->mutex);
 
-	AudioRenderer_UnLoad(am->active_ar);
+	// the preloaded file was predicted for what is playing now
+	atomic_store(&am->next, AM_SLOT_NONE);
+
+	slot = AudioManager_FreeSlot(am);
+
+	if (am->slots[slot].ar != NULL) {
+		AudioRenderer_UnLoad(am->slots[slot].ar);
+		am->slots[slot].ar = NULL;
+	}
+
+	rend = AudioManager_LoadSlot(am, slot,
+	                             AudioManager_RendererIdx(am, rend), prepared,
+	                             filename, data, len);
+
+	if (rend != NULL) {
+		am->slots[slot].ar = rend;
+		AudioManager_Publish(am, slot);
+
+		AudioOutput_Start(am->out);
+		am->playing = true;
+		SDL_SemPost(am->sem);
 
-	if (rend != NULL && !AudioManager_TryLoad(am, rend, filename, data, len)) {
 		r = 0;
 	} else {
-		p = am->ars;
-
-		while (*p != NULL) {
-			if (!AudioManager_TryLoad(am, rend, filename, data, len)) {
-				r = 0;
-				break;
-			}
+		AudioManager_Publish(am, AM_SLOT_NONE);
 
-			p++;
-		}
+		AudioOutput_Stop(am->out);
+		am->playing = false;
 	}
 
+	AudioManager_UnLoadStale(am);
+
 	SDL_UnlockMutex(am->mutex);
 
 	return r;
@@ -130,58 +330,560 @@ AudioManager_Load(AudioManager* am,
 bool
 AudioManager_AlterSubTrack(AudioManager* am, int val)
 {
+	AudioManager_NowPlaying now;
 	int track_sel;
-	int ntracks;
-	int r = -1;
 
 	assert(am);
-	assert(am->active_ar);
 
-	ntracks = AudioRenderer_NTracks(am->active_ar);
+	AudioManager_GetNowPlaying(am, &now);
 
-	if (ntracks < 2)
+	if (now.ntracks < 2)
 		return false;
 
-	SDL_LockMutex(am->mutex);
+	// the render thread owns the renderer, so the change is handed over
+	// and applied between two render calls
+	track_sel = atomic_load(&am->track_req);
 
-	track_sel = AudioRenderer_Track(am->active_ar) + val;
+	if (track_sel < 0)
+		track_sel = now.track;
 
-	if (track_sel >= 0 && track_sel < ntracks) {
-		r = AudioRenderer_SetTrack(am->active_ar, track_sel);
-		atomic_store(&am->cb_msg, CBM_CLR_BUF);
+	track_sel += val;
+
+	if (track_sel < 0 || track_sel >= now.ntracks)
+		return false;
+
+	atomic_store(&am->track_req, track_sel);
+	SDL_SemPost(am->sem);
+
+	return true;
+}
+
+// Moves the track ms from where it plays, or from a seek still pending.
+bool
+AudioManager_Seek(AudioManager* am, int ms)
+{
+	int pos;
+
+	assert(am);
+
+	if (!AudioManager_Loaded(am))
+		return false;
+
+	pos = atomic_load(&am->seek_req);
+
+	if (pos < 0) {
+		SDL_LockMutex(am->now_mutex);
+		pos = am->now.play_time * 1000;
+		SDL_UnlockMutex(am->now_mutex);
 	}
 
-	SDL_UnlockMutex(am->mutex);
+	atomic_store(&am->seek_req, max_int(pos + ms, 0));
+	SDL_SemPost(am->sem);
+
+	return true;
+}
 
-	return (r != -1) && (r == track_sel);
+// Whether a subtrack change or a seek has yet to be applied.
+bool
+AudioManager_TrackPending(AudioManager* am)
+{
+	assert(am);
+
+	return atomic_load(&am->track_req) >= 0
+	       || atomic_load(&am->seek_req) >= 0;
 }
 
+// frame, if not NULL, is set to where in the track the silence began.
 bool
-AudioManager_SilenceDetected(AudioManager* am)
+AudioManager_SilenceDetected(AudioManager* am,
+                             size_t* frame)
 {
 	bool r = false;
 
 	assert(am);
 
-	if (atomic_load(&am->rt_msg) == RTM_AUTO_INC)
+	if (atomic_load(&am->rt_msg) == RTM_AUTO_INC) {
 		r = true;
 
+		if (frame)
+			*frame = atomic_load(&am->silence_at);
+	}
+
 	atomic_store(&am->rt_msg, RTM_NONE);
 
 	return r;
 }
 
+// Threshold and hysteresis in dBFS, minimum duration in milliseconds. The
+// detector belongs to the render thread, so this is only to be called
+// before the first Load.
+void
+AudioManager_SetSilence(AudioManager* am,
+                        float threshold_db,
+                        float hysteresis_db,
+                        int min_ms)
+{
+	assert(am);
+
+	SilenceDetector_Init(&am->sd, am->fs, am->bits, am->channels,
+	                     threshold_db, hysteresis_db, min_ms);
+}
+
+void
+AudioManager_Preload(AudioManager* am,
+                     const char* filename,
+                     void* data,
+                     size_t len,
+                     void (*free_data)(void*, size_t))
+{
+	assert(am);
+	assert(am->preload_thread);
+	assert(free_data);
+
+	// takes over data, to be released with free_data, a request not yet
+	// picked up is replaced
+	SDL_LockMutex(am->preload_mutex);
+
+	if (am->preload_req.data != NULL)
+		am->preload_req.free_data(am->preload_req.data, am->preload_req.len);
+
+	snprintf(am->preload_req.filename, MODP_STR_LENGTH, "%s", filename);
+	am->preload_req.data = data;
+	am->preload_req.len = len;
+	am->preload_req.free_data = free_data;
+	am->preload_req.base = atomic_load(&am->active);
+	am->preload_req.gen = atomic_load(&am->preload_gen);
+
+	SDL_UnlockMutex(am->preload_mutex);
+
+	SDL_SemPost(am->preload_sem);
+}
+
+// Drops the preloaded file, and a preload not done yet, when what comes
+// next is no longer known, as after a change of directory.
+void
+AudioManager_CancelPreload(AudioManager* am)
+{
+	assert(am);
+
+	SDL_LockMutex(am->preload_mutex);
+
+	atomic_fetch_add(&am->preload_gen, 1);
+
+	if (am->preload_req.data != NULL) {
+		am->preload_req.free_data(am->preload_req.data, am->preload_req.len);
+		am->preload_req.data = NULL;
+	}
+
+	SDL_UnlockMutex(am->preload_mutex);
+
+	SDL_LockMutex(am->mutex);
+
+	atomic_store(&am->next, AM_SLOT_NONE);
+	AudioManager_UnLoadStale(am);
+
+	SDL_UnlockMutex(am->mutex);
+}
+
+void
+AudioManager_SetAutoAdvance(AudioManager* am,
+                            bool advance,
+                            bool subtracks)
+{
+	assert(am);
+
+	atomic_store(&am->auto_advance, advance);
+	atomic_store(&am->auto_subtrack, subtracks);
+}
+
+bool
+AudioManager_GaplessReady(AudioManager* am)
+{
+	bool r;
+
+	assert(am);
+
+	if (atomic_load(&am->next) != AM_SLOT_NONE)
+		return true;
+
+	SDL_LockMutex(am->now_mutex);
+	r = am->now.loaded && am->now.track + 1 < am->now.ntracks;
+	SDL_UnlockMutex(am->now_mutex);
+
+	return atomic_load(&am->auto_subtrack) && r;
+}
+
+// Whether a file is published, only a loaded renderer ever is.
+bool
+AudioManager_Loaded(AudioManager* am)
+{
+	assert(am);
+
+	return AM_SLOT(atomic_load(&am->active)) != AM_SLOT_NONE;
+}
+
+void
+AudioManager_GetNowPlaying(AudioManager* am,
+                           AudioManager_NowPlaying* now)
+{
+	assert(am);
+	assert(now);
+
+	SDL_LockMutex(am->now_mutex);
+	*now = am->now;
+	SDL_UnlockMutex(am->now_mutex);
+}
+
+RenderThreadMessage
+AudioManager_Advanced(AudioManager* am)
+{
+	assert(am);
+
+	return atomic_exchange(&am->adv_msg, RTM_NONE);
+}
+
+void
+AudioManager_GetOutputStats(AudioManager* am,
+                            AudioManager_OutputStats* stats)
+{
+	assert(am);
+	assert(am->out);
+	assert(stats);
+
+	stats->name = AudioOutput_Name(am->out);
+	stats->latency = AudioOutput_Latency(am->out);
+	stats->underruns = atomic_load(&am->underruns);
+	stats->xruns = AudioOutput_XRuns(am->out);
+}
+
+// Starts the track of slot over, as far as the render thread is concerned.
+static void
+AudioManager_TrackStart(AudioManager* am,
+                        AudioManager_Slot* slot)
+{
+	slot->frames = 0;
+	slot->silent = false;
+	slot->ended = false;
+
+	SilenceDetector_Reset(&am->sd);
+}
+
+static unsigned int
+AudioManager_AcquireActive(AudioManager* am)
+{
+	unsigned int v;
+
+	// announce the slot, then make sure it was not replaced in between,
+	// otherwise a control operation could already consider it free
+	do {
+		v = atomic_load(&am->active);
+		atomic_store(&am->rendering, AM_SLOT(v));
+	} while (atomic_load(&am->active) != v);
+
+	return v;
+}
+
+static void
+AudioManager_ClearBuffer(AudioManager* am)
+{
+	atomic_store(&am->clr_pos, RingBuffer_WritePos(am->render_buf));
+	atomic_store(&am->cb_msg, CBM_CLR_BUF);
+}
+
+// Renders n samples in the output format at dst, through the resampler
+// when the renderers run at another rate. Only the resampler's own work
+// is timed, for its cost per second of audio.
+static void
+AudioManager_Render(AudioManager* am,
+                    AudioRenderer* ar,
+                    void* dst,
+                    int n)
+{
+	size_t frames = n / am->channels;
+
+	if (am->rs == NULL) {
+		AudioRenderer_Render(ar, dst, n * Sample_Bytes(am->bits));
+		return;
+	}
+
+	while (frames > 0) {
+		size_t chunk = frames < AM_RS_FRAMES ? frames : AM_RS_FRAMES;
+		size_t need = Resampler_InputNeeded(am->rs, chunk);
+		Uint64 t_start;
+
+		AudioRenderer_Render(ar, am->rs_in,
+		                     need * am->channels * sizeof(float));
+
+		t_start = SDL_GetPerformanceCounter();
+
+		Resampler_Write(am->rs, am->rs_in, need);
+		Resampler_Process(am->rs, am->rs_out, chunk);
+		Sample_FromFloat(dst, am->bits, am->rs_out, chunk * am->channels);
+
+		atomic_fetch_add(&am->rs_ticks, SDL_GetPerformanceCounter() - t_start);
+		atomic_fetch_add(&am->rs_frames, chunk);
+
+		dst = (char*) dst + chunk * Sample_FrameBytes(am->bits, am->channels);
+		frames -= chunk;
+	}
+}
+
+// The resampler starts over with a stream that does not continue the
+// previous one, so no history of it leaks into the new one.
+static void
+AudioManager_ResetResampler(AudioManager* am)
+{
+	if (am->rs != NULL)
+		Resampler_Reset(am->rs);
+}
+
+bool
+AudioManager_GetResamplerStats(AudioManager* am,
+                               AudioManager_ResamplerStats* stats)
+{
+	uint64_t frames;
+
+	assert(am);
+	assert(stats);
+
+	if (am->rs == NULL)
+		return false;
+
+	frames = atomic_load(&am->rs_frames);
+
+	stats->quality = Resampler_QualityName(am->rs->quality);
+	stats->isa = am->rs->isa;
+	stats->in_fs = am->render_fs;
+	stats->out_fs = am->fs;
+	stats->cost = frames > 0
+	              ? (double) atomic_load(&am->rs_ticks)
+	                / SDL_GetPerformanceFrequency()
+	                / ((double) frames / am->fs)
+	              : 0;
+
+	return true;
+}
+
+// Renders n samples into span, starting ofs samples into it, and passes
+// them through the silence detector. Returns true if it reported silence.
+// Without a renderer the samples are silence.
+static bool
+AudioManager_RenderSpan(AudioManager* am,
+                        AudioRenderer* ar,
+                        RingBuffer_Span* span,
+                        size_t sample_bytes,
+                        int ofs,
+                        int n)
+{
+	bool silence = false;
+
+	for (int i = 0; i < 2 && n > 0; i++) {
+		char* dst;
+		int part;
+
+		if (ofs >= span->len[i]) {
+			ofs -= span->len[i];
+			continue;
+		}
+
+		part = min_int(n, span->len[i] - ofs);
+		dst = (char*) span->ptr[i] + ofs * sample_bytes;
+
+		if (ar != NULL)
+			AudioManager_Render(am, ar, dst, part);
+		else
+			memset(dst, 0, part * sample_bytes);
+
+		if (SilenceDetector_Process(&am->sd, dst, part / am->channels))
+			silence = true;
+
+		ofs = 0;
+		n -= part;
+	}
+
+	return silence;
+}
+
+// How many of n samples can be rendered before the end of the track, n if
+// the track is not to be left at its end.
+static int
+AudioManager_ToTrackEnd(AudioManager* am,
+                        AudioRenderer* ar,
+                        AudioManager_Slot* slot,
+                        int n)
+{
+	int length;
+	size_t end;
+
+	if (!atomic_load(&am->auto_advance))
+		return n;
+
+	if (slot->silent)
+		return 0;
+
+	// renderers report an unknown length as one second past the play time
+	length = AudioRenderer_Length(ar);
+
+	if (length <= 0)
+		return n;
+
+	end = (size_t) length * am->fs;
+
+	if (slot->frames >= end)
+		return 0;
+
+	return (end - slot->frames) * am->channels < (size_t) n
+	       ? (int) ((end - slot->frames) * am->channels)
+	       : n;
+}
+
+// Moves the track of slot towards ms. Renderers that cannot seek fast get
+// there a step per pass, so a long seek does not hold up the control
+// operations, and a newer request takes over from the next step on.
+static void
+AudioManager_SeekStep(AudioManager* am,
+                      AudioRenderer* ar,
+                      unsigned int active,
+                      int ms)
+{
+	AudioManager_Slot* slot = &am->slots[AM_SLOT(active)];
+	int pos = (int) (slot->frames * 1000 / am->fs);
+	int step = ms;
+
+	if (!AudioRenderer_CanSeekFast(ar))
+		step = ms < pos ? 0 : min_int(ms, pos + AM_SEEK_STEP_MS);
+
+	pos = AudioRenderer_Seek(ar, step);
+
+	AudioManager_ClearBuffer(am);
+	AudioManager_ResetResampler(am);
+	AudioManager_TrackStart(am, slot);
+
+	if (pos >= 0)
+		slot->frames = (size_t) pos * am->fs / 1000;
+
+	// shown before the seek is done with
+	AudioManager_UpdateNow(am, ar, active);
+
+	// the renderer failed or stopped short of the step, there is no
+	// getting any further
+	if (pos < 0 || pos != step || step == ms)
+		atomic_compare_exchange_strong(&am->seek_req, &ms, -1);
+	else
+		SDL_SemPost(am->sem);
+}
+
+// Sets the quality of a renderer that starts playing to the governor's
+// level, or what it has closest.
+static void
+AudioManager_GovernStart(AudioManager* am,
+                         AudioRenderer* ar)
+{
+	am->quality = AudioRenderer_SetQuality(ar, am->quality);
+	am->gov_ticks = 0;
+	am->gov_frames = 0;
+	am->gov_low = 0;
+}
+
+// Counts ticks spent rendering frames, and at the end of a window steps
+// the quality down when rendering takes too much of real time, or back up
+// once it has had room to spare for a while.
+static void
+AudioManager_Govern(AudioManager* am,
+                    AudioRenderer* ar,
+                    uint64_t ticks,
+                    size_t frames)
+{
+	double cost;
+
+	am->gov_ticks += ticks;
+	am->gov_frames += frames;
+
+	if (am->gov_frames < (size_t) am->fs * AM_GOV_WINDOW_MS / 1000)
+		return;
+
+	cost = (double) am->gov_ticks / SDL_GetPerformanceFrequency()
+	       / ((double) am->gov_frames / am->fs);
+
+	am->gov_ticks = 0;
+	am->gov_frames = 0;
+	am->gov_low = cost < AM_GOV_LOW ? am->gov_low + 1 : 0;
+
+	if (cost > AM_GOV_HIGH) {
+		// a renderer at its cheapest stays where it is
+		if (AudioRenderer_SetQuality(ar, am->quality + 1) > am->quality) {
+			am->quality++;
+
+			if (DEBUG)
+				fprintf(stderr, "render cost %.0f%%, quality level %d\n",
+				        cost * 100, am->quality);
+		}
+	} else if (am->gov_low >= AM_GOV_UP_WINDOWS && am->quality > 0) {
+		am->quality = AudioRenderer_SetQuality(ar, am->quality - 1);
+		am->gov_low = 0;
+
+		if (DEBUG)
+			fprintf(stderr, "render cost %.0f%%, quality level %d\n",
+			        cost * 100, am->quality);
+	}
+}
+
+// Moves on from the end of a track to the next subtrack or to the
+// preloaded slot, continuing in the same ring. Returns false if there is
+// nothing to move on to yet.
+static bool
+AudioManager_AdvanceTrack(AudioManager* am,
+                          AudioRenderer** ar,
+                          unsigned int* active)
+{
+	int track = AudioRenderer_Track(*ar);
+	unsigned int next;
+	bool r = false;
+
+	if (atomic_load(&am->auto_subtrack)
+	        && track + 1 < AudioRenderer_NTracks(*ar)) {
+		AudioRenderer_SetTrack(*ar, track + 1);
+		AudioManager_TrackStart(am, &am->slots[AM_SLOT(*active)]);
+		AudioManager_UpdateNow(am, *ar, *active);
+		atomic_store(&am->adv_msg, RTM_ADV_TRACK);
+
+		return true;
+	}
+
+	// a control operation holding the lock replaces the renderer anyway,
+	// so rather than waiting for it, the switch is retried next chunk
+	if (SDL_TryLockMutex(am->mutex) != 0)
+		return false;
+
+	next = atomic_load(&am->next);
+
+	if (next != AM_SLOT_NONE && atomic_load(&am->active) == *active) {
+		atomic_store(&am->rendering, next);
+		atomic_store(&am->next, AM_SLOT_NONE);
+		AudioManager_Publish(am, next);
+
+		*active = atomic_load(&am->active);
+		*ar = am->slots[next].ar;
+		AudioManager_TrackStart(am, &am->slots[next]);
+		AudioManager_GovernStart(am, *ar);
+
+		atomic_store(&am->adv_msg, RTM_ADV_NEXT);
+		r = true;
+	}
+
+	SDL_UnlockMutex(am->mutex);
+
+	return r;
+}
+
 static int
 RenderThread(void* data)
 {
 	AudioManager* am = (AudioManager*) data;
 	assert(am);
 
-	size_t silence_count = 0;
-
-	T* temp = (T*) calloc(MODP_RNDR_BUF_SEC * am->fs * am->channels,
-	                      sizeof(T));
-	assert(temp);
+	size_t sample_bytes = Sample_Bytes(am->bits);
+	unsigned int last_active = atomic_load(&am->active);
 
 	while (am->running) {
 		size_t rb_ct = RingBuffer_Count(am->render_buf);
@@ -191,105 +893,407 @@ RenderThread(void* data)
 		                 * am->channels
 		                 / 4;
 
-		size_t rendered = 0;
+		RingBuffer_Span span = { { NULL, NULL }, { 0, 0 } };
+		int reserved = 0;
+
+		AudioRenderer* ar = NULL;
+		unsigned int active;
+		int track, seek;
 
 		SDL_SemWait(am->sem);
 
-		SDL_LockMutex(am->mutex);
+		active = AudioManager_AcquireActive(am);
+
+		if (AM_SLOT(active) != AM_SLOT_NONE)
+			ar = am->slots[AM_SLOT(active)].ar;
 
-		if (atomic_load(&am->playing) && rb_ct < samples
-		        && AudioRenderer_Loaded(am->active_ar)) {
-			rendered = AudioRenderer_Render(am->active_ar,
-			                                temp,
-			                                samples * sizeof(T));
+		// everything written so far belongs to the previous renderer
+		if (active != last_active) {
+			AudioManager_ClearBuffer(am);
+			AudioManager_ResetResampler(am);
+			last_active = active;
 
-			RingBuffer_Write(am->render_buf, temp, samples);
+			if (ar != NULL) {
+				AudioManager_TrackStart(am, &am->slots[AM_SLOT(active)]);
+				AudioManager_GovernStart(am, ar);
+			}
 		}
 
-		SDL_UnlockMutex(am->mutex);
+		track = atomic_load(&am->track_req);
+
+		if (track >= 0 && ar != NULL && AudioRenderer_Loaded(ar)) {
+			AudioRenderer_SetTrack(ar, track);
+			AudioManager_ClearBuffer(am);
+			AudioManager_ResetResampler(am);
+			AudioManager_TrackStart(am, &am->slots[AM_SLOT(active)]);
+			AudioManager_UpdateNow(am, ar, active);
+		}
+
+		// only cleared once shown, a newer request is taken next pass
+		if (track >= 0)
+			atomic_compare_exchange_strong(&am->track_req, &track, -1);
+
+		seek = atomic_load(&am->seek_req);
+
+		if (seek >= 0) {
+			if (ar != NULL && AudioRenderer_Loaded(ar))
+				AudioManager_SeekStep(am, ar, active, seek);
+			else
+				atomic_store(&am->seek_req, -1);
+		}
 
-		if (atomic_load(&am->rt_msg) == RTM_NONE
-		        && atomic_load(&am->playing)) {
-			rendered /= sizeof(T);
-			for (size_t i = 0; rendered > 0 && i <= rendered - 4; i += 2) {
-				int l_diff = temp[i + 0] - temp[i + 2];
-				int r_diff = temp[i + 1] - temp[i + 3];
-
-				if (l_diff == 0 && r_diff == 0)
-					silence_count++;
-				else
-					silence_count = 0;
+		// nothing is rendered halfway through a seek
+		if (ar != NULL && atomic_load(&am->playing) && rb_ct < samples
+		        && atomic_load(&am->seek_req) < 0
+		        && AudioRenderer_Loaded(ar)) {
+			int rendered = 0;
+			Uint64 t_start = SDL_GetPerformanceCounter();
+
+			// render straight into the ring, up to the end of the track at
+			// a time, so the next one continues on the following sample
+			reserved = RingBuffer_WriteReserve(am->render_buf,
+			                                   samples,
+			                                   &span);
+
+			while (rendered < reserved) {
+				AudioManager_Slot* slot = &am->slots[AM_SLOT(active)];
+				int n = AudioManager_ToTrackEnd(am, ar, slot,
+				                                reserved - rendered);
+
+				if (n == 0) {
+					if (AudioManager_AdvanceTrack(am, &ar, &active)) {
+						last_active = active;
+						continue;
+					}
+
+					// nothing to move on to, keep playing, and leave a
+					// silent track to the control thread
+					if (slot->silent) {
+						slot->silent = false;
+						atomic_store(&am->rt_msg, RTM_AUTO_INC);
+					}
+
+					n = reserved - rendered;
+				}
+
+				// the render thread moves on from a silent or ended track
+				// itself when it may, otherwise the control thread is told,
+				// and nothing past the end is rendered
+				if (AudioManager_RenderSpan(am, slot->ended ? NULL : ar,
+				                            &span, sample_bytes,
+				                            rendered, n)) {
+					atomic_store(&am->silence_at,
+					             SilenceDetector_Start(&am->sd));
+
+					if (atomic_load(&am->auto_advance))
+						slot->silent = true;
+					else
+						atomic_store(&am->rt_msg, RTM_AUTO_INC);
+				}
+
+				if (!slot->ended && AudioRenderer_Ended(ar)) {
+					slot->ended = true;
+
+					if (atomic_load(&am->auto_advance))
+						slot->silent = true;
+					else
+						atomic_store(&am->rt_msg, RTM_AUTO_INC);
+				}
+
+				slot->frames += n / am->channels;
+				rendered += n;
 			}
+
+			AudioManager_Govern(am, ar, SDL_GetPerformanceCounter() - t_start,
+			                    reserved / am->channels);
+			AudioManager_UpdateNow(am, ar, active);
+
+			// drop the chunk if another renderer was published meanwhile
+			if (atomic_load(&am->active) == active)
+				RingBuffer_WriteCommit(am->render_buf, reserved);
 		}
 
-		if (silence_count > am->max_silence) {
-			atomic_store(&am->rt_msg, RTM_AUTO_INC);
-			silence_count = 0;
+		atomic_store(&am->rendering, AM_SLOT_NONE);
+	}
+
+	return 0;
+}
+
+static int
+PreloadThread(void* data)
+{
+	AudioManager* am = (AudioManager*) data;
+	assert(am);
+
+	while (am->running) {
+		AudioManager_PreloadReq req;
+		AudioRenderer* rend = NULL;
+		void* prepared;
+		int slot, idx;
+
+		SDL_SemWait(am->preload_sem);
+
+		SDL_LockMutex(am->preload_mutex);
+		req = am->preload_req;
+		am->preload_req.data = NULL;
+		SDL_UnlockMutex(am->preload_mutex);
+
+		if (req.data == NULL)
+			continue;
+
+		// the new prediction replaces the old one, and stale slots are
+		// unloaded, then the slot is reserved so the lock is not held
+		// during the load
+		SDL_LockMutex(am->mutex);
+
+		if (atomic_load(&am->active) != req.base
+		        || atomic_load(&am->preload_gen) != req.gen) {
+			SDL_UnlockMutex(am->mutex);
+			req.free_data(req.data, req.len);
+			continue;
 		}
+
+		atomic_store(&am->next, AM_SLOT_NONE);
+		AudioManager_UnLoadStale(am);
+
+		slot = AudioManager_FreeSlot(am);
+		am->preloading = slot;
+
+		SDL_UnlockMutex(am->mutex);
+
+		// the slot is reserved, so its own instances can be probed safely
+		idx = AudioManager_Resolve(am->slots[slot].ars,
+		                           req.filename, req.data, req.len,
+		                           &prepared);
+
+		if (idx >= 0)
+			rend = AudioManager_LoadSlot(am, slot, idx, prepared,
+			                             req.filename, req.data, req.len);
+
+		SDL_LockMutex(am->mutex);
+
+		am->preloading = AM_SLOT_NONE;
+
+		if (rend != NULL && atomic_load(&am->active) == req.base
+		        && atomic_load(&am->preload_gen) == req.gen) {
+			am->slots[slot].ar = rend;
+			atomic_store(&am->next, slot);
+		} else if (rend != NULL) {
+			AudioRenderer_UnLoad(rend);
+		}
+
+		SDL_UnlockMutex(am->mutex);
+
+		req.free_data(req.data, req.len);
 	}
 
+	return 0;
+}
+
+int
+AudioManager_RenderToFile(AudioManager* am,
+                          const char* filename,
+                          void* data,
+                          size_t len,
+                          const char* out_path,
+                          int max_sec,
+                          AudioManager_RenderStats* stats)
+{
+	AudioRenderer* rend;
+	void* prepared;
+	WavFile* wf;
+	void* temp;
+	Uint64 t_start;
+
+	size_t samples = MODP_RNDR_BUF_SEC * am->fs * am->channels / 4;
+	size_t sample_bytes = Sample_Bytes(am->bits);
+	size_t max_frames = (size_t) max_sec * am->fs;
+	size_t frames = 0;
+
+	assert(am);
+	assert(am->thread == NULL);
+	assert(stats);
+
+	memset(stats, 0, sizeof(AudioManager_RenderStats));
+
+	rend = AudioManager_CanLoad(am, filename, data, len, &prepared);
+
+	if (rend == NULL) {
+		fprintf(stderr, "%s: unsupported file\n", filename);
+		return 1;
+	}
+
+	if (AudioRenderer_Load(rend, filename, data, len, prepared)) {
+		fprintf(stderr, "%s: load failed\n", filename);
+		return 1;
+	}
+
+	wf = WavFile_Open(out_path, am->fs, am->bits, am->channels);
+
+	if (wf == NULL) {
+		fprintf(stderr, "%s: could not open for writing\n", out_path);
+		AudioRenderer_UnLoad(rend);
+		return 1;
+	}
+
+	temp = calloc(samples, sample_bytes);
+	assert(temp);
+
+	t_start = SDL_GetPerformanceCounter();
+
+	while (frames < max_frames) {
+		size_t n = min_int(samples, (max_frames - frames) * am->channels);
+		int length = AudioRenderer_Length(rend);
+
+		// renderers without a known length report one second past the
+		// current play time, so only max_frames or the renderer's own
+		// end stops those
+		if (frames > 0 && (AudioRenderer_Ended(rend) || (length > 0
+		        && AudioRenderer_PlayTime(rend) >= length)))
+			break;
+
+		AudioManager_Render(am, rend, temp, n);
+
+		if (WavFile_Write(wf, temp, n * sample_bytes) != n * sample_bytes) {
+			fprintf(stderr, "%s: write failed\n", out_path);
+			break;
+		}
+
+		frames += n / am->channels;
+	}
+
+	stats->elapsed = (double) (SDL_GetPerformanceCounter() - t_start)
+	                 / SDL_GetPerformanceFrequency();
+	stats->frames = frames;
+	stats->seconds = (double) frames / am->fs;
+
 	free(temp);
+	WavFile_Close(wf);
+	AudioRenderer_UnLoad(rend);
 
 	return 0;
 }
 
-static int
-PortAudio_Callback(const void* in, void* out,
-                   unsigned long frames,
-                   const PaStreamCallbackTimeInfo* time_info,
-                   PaStreamCallbackFlags status_flags,
-                   void* user)
+// Feeds the visualization tap, which is float stereo whatever the format
+// of the pipeline. Frames that do not fit are dropped.
+static void
+AudioManager_Tap(AudioManager* am,
+                 const void* src,
+                 int n)
 {
-	AudioManager* am = (AudioManager*) user;
-	T* pa_out = (T*) out;
+	RingBuffer_Span span;
+	size_t frame_bytes = Sample_FrameBytes(am->bits, am->channels);
+	int reserved;
+
+	// the tap only ever moves in whole stereo frames, so both parts of
+	// the span hold whole frames as well
+	reserved = RingBuffer_WriteReserve(am->playback_buf,
+	                                   n / am->channels * 2,
+	                                   &span);
+
+	for (int i = 0; i < 2; i++) {
+		Sample_ToFloatStereo((float*) span.ptr[i], src, am->bits,
+		                     am->channels, span.len[i] / 2);
+
+		src = (const char*) src + span.len[i] / 2 * frame_bytes;
+	}
 
-	(void) in;
-	(void) time_info;
-	(void) status_flags;
+	RingBuffer_WriteCommit(am->playback_buf, reserved);
+}
 
+static void
+AudioManager_Callback(void* out,
+                      unsigned long frames,
+                      void* user)
+{
+	AudioManager* am = (AudioManager*) user;
+	char* pa_out = (char*) out;
+	size_t sample_bytes = Sample_Bytes(am->bits);
+
+	RingBuffer_Span span;
 	int to_write;
 	int written;
 
 	if (atomic_load(&am->cb_msg) == CBM_CLR_BUF) {
-		RingBuffer_ConsumerClear(am->render_buf);
 		atomic_store(&am->cb_msg, CBM_NONE);
+		RingBuffer_ConsumerSkip(am->render_buf, atomic_load(&am->clr_pos));
+		// the gap while the new renderer starts up is not an underrun
+		am->cb_fed = false;
 	}
 
 	to_write = frames * am->channels;
-	written = RingBuffer_Read(am->render_buf, pa_out, to_write);
+	written = RingBuffer_ReadPeek(am->render_buf, to_write, &span);
+
+	memcpy(pa_out, span.ptr[0], span.len[0] * sample_bytes);
+	memcpy(pa_out + span.len[0] * sample_bytes, span.ptr[1],
+	       span.len[1] * sample_bytes);
+
+	// the visualization tap is fed from the ring as well, before the
+	// samples are handed back to the producer
+	AudioManager_Tap(am, span.ptr[0], span.len[0]);
+	AudioManager_Tap(am, span.ptr[1], span.len[1]);
 
-	if (written < to_write)
-		memset(pa_out + written, 0, (to_write - written) * sizeof(T));
+	RingBuffer_ReadRelease(am->render_buf, written);
+
+	if (written < to_write) {
+		memset(pa_out + written * sample_bytes, 0,
+		       (to_write - written) * sample_bytes);
+
+		if (am->cb_fed)
+			atomic_fetch_add(&am->underruns, 1);
+
+		am->cb_fed = false;
+	} else {
+		am->cb_fed = true;
+	}
 
 	if (RingBuffer_Count(am->render_buf)
 	        < (int) MODP_RNDR_BUF_SEC * am->fs * am->channels / 2)
 		SDL_SemPost(am->sem);
-
-	RingBuffer_Write(am->playback_buf, out, to_write);
-
-	return 0;
 }
 
-static void
-PortAudio_Init(AudioManager* am)
+// The output is chosen by name, optionally followed by a colon and an
+// argument: "portaudio", "alsa[:DEVICE]", "null", "wav:PATH" or "raw:PATH".
+static AudioOutput*
+AudioManager_CreateOutput(AudioManager* am,
+                          const char* spec)
 {
-	assert(am->fs == 48e3);
-	assert(am->bits == 16);
+	const char* arg = NULL;
+	size_t name_len;
+
+	if (spec == NULL || *spec == '\0')
+		spec = "portaudio";
 
-	am->pa_err = Pa_Initialize();
+	name_len = strcspn(spec, ":");
 
-	assert(am->pa_err == paNoError);
+	if (spec[name_len] == ':')
+		arg = spec + name_len + 1;
 
-	am->pa_err = Pa_OpenDefaultStream(&am->stream,
-	                                  0,
-	                                  am->channels,
-	                                  paInt16,
-	                                  am->fs,
-	                                  1536,
-	                                  PortAudio_Callback,
-	                                  (void*) am);
+#define IS_OUTPUT(n) (name_len == strlen((n)) && strncmp(spec, (n), name_len) == 0)
 
-	assert(am->pa_err == paNoError);
+	if (IS_OUTPUT("portaudio"))
+		return PortAudioOutput_Create(am->fs, am->bits, am->channels,
+		                              AudioManager_Callback, (void*) am);
+#ifdef HAVE_LIBASOUND
+	if (IS_OUTPUT("alsa"))
+		return AlsaOutput_Create(arg, am->fs, am->bits, am->channels,
+		                         AudioManager_Callback, (void*) am);
+#endif
+	if (IS_OUTPUT("null"))
+		return FileOutput_Create(FOF_NULL, NULL,
+		                         am->fs, am->bits, am->channels,
+		                         AudioManager_Callback, (void*) am);
+
+	if ((IS_OUTPUT("wav") || IS_OUTPUT("raw")) && arg != NULL && *arg)
+		return FileOutput_Create(IS_OUTPUT("wav") ? FOF_WAV : FOF_RAW, arg,
+		                         am->fs, am->bits, am->channels,
+		                         AudioManager_Callback, (void*) am);
+
+#undef IS_OUTPUT
+
+	fprintf(stderr, "%s: unknown or unavailable output\n", spec);
+
+	return NULL;
 }
 
 void
@@ -300,34 +1304,46 @@ AudioManager_Destroy(AudioManager* am)
 
 	assert(am);
 
-	if (am->playing) {
-		am->pa_err = Pa_StopStream(am->stream);
-		assert(am->pa_err == paNoError);
+	if (am->out != NULL) {
+		AudioOutput_Destroy(am->out);
+		am->out = NULL;
+		am->playing = false;
 	}
 
-	am->playing = false;
-
-	am->pa_err = Pa_CloseStream(am->stream);
-	assert(am->pa_err == paNoError);
+	if (am->thread != NULL) {
+		am->running = false;
 
-	Pa_Terminate();
+		SDL_SemPost(am->sem);
+		SDL_SemPost(am->preload_sem);
 
-	SDL_LockMutex(am->mutex);
+		SDL_WaitThread(am->thread, &status);
+		SDL_WaitThread(am->preload_thread, &status);
 
-	am->running = false;
+		SDL_DestroySemaphore(am->sem);
+		SDL_DestroySemaphore(am->preload_sem);
+		SDL_DestroyMutex(am->preload_mutex);
+		if (am->preload_req.data != NULL)
+			am->preload_req.free_data(am->preload_req.data,
+			                          am->preload_req.len);
 
-	SDL_UnlockMutex(am->mutex);
+		RingBuffer_Destroy(am->render_buf);
+		RingBuffer_Destroy(am->playback_buf);
+	}
 
-	SDL_SemPost(am->sem);
+	SDL_DestroyMutex(am->mutex);
+	SDL_DestroyMutex(am->now_mutex);
 
-	SDL_WaitThread(am->thread, &status);
+	for (int i = 0; i < MODP_AM_SLOTS; i++) {
+		if (am->slots[i].ars == NULL)
+			continue;
 
-	SDL_DestroyMutex(am->mutex);
+		p = am->slots[i].ars;
 
-	SDL_DestroySemaphore(am->sem);
+		while (*p != NULL)
+			AudioRenderer_Destroy(*p++);
 
-	RingBuffer_Destroy(am->render_buf);
-	RingBuffer_Destroy(am->playback_buf);
+		free(am->slots[i].ars);
+	}
 
 	p = am->ars;
 
@@ -335,13 +1351,63 @@ AudioManager_Destroy(AudioManager* am)
 		AudioRenderer_Destroy(*p++);
 
 	free(am->ars);
+
+	if (am->rs != NULL) {
+		Resampler_Destroy(am->rs);
+		free(am->rs_in);
+		free(am->rs_out);
+	}
+
 	free(am);
 
 	return;
 }
 
-AudioManager*
-AudioManager_Create(int fs, int bits, int channels)
+static AudioRenderer**
+AudioManager_CreateRenderers(int fs, int bits, int channels)
+{
+	AudioRenderer** ars;
+
+#ifdef HAVE_OPENMPT
+	ars = (AudioRenderer**) calloc(6, sizeof(AudioRenderer*));
+#else
+	ars = (AudioRenderer**) calloc(5, sizeof(AudioRenderer*));
+#endif
+	assert(ars);
+
+	ars[0] = SIDRenderer_Create(fs, bits, channels);
+	ars[1] = XMPRenderer_Create(fs, bits, channels);
+	ars[2] = HVLRenderer_Create(fs, bits, channels);
+	ars[3] = GMERenderer_Create(fs, bits, channels);
+#ifndef HAVE_OPENMPT
+	ars[4] = NULL;
+#else
+	ars[4] = OpenMPTRenderer_Create(fs, bits, channels);
+	ars[5] = NULL;
+#endif
+
+	return ars;
+}
+
+static bool
+AudioManager_ValidFormat(int fs, int bits, int channels, int render_fs)
+{
+	if (Sample_ValidFormat(fs, bits, channels)
+	        && (render_fs == 0 || Sample_ValidFormat(render_fs, bits, channels)))
+		return true;
+
+	fprintf(stderr, "%d Hz, %d bits, %d channels, rendered at %d Hz: "
+	        "unsupported format\n", fs, bits, channels, render_fs);
+
+	return false;
+}
+
+static AudioManager*
+AudioManager_Alloc(int fs,
+                   int bits,
+                   int channels,
+                   int render_fs,
+                   Resampler_Quality quality)
 {
 	AudioManager* am;
 
@@ -351,42 +1417,116 @@ AudioManager_Create(int fs, int bits, int channels)
 	am->fs = fs;
 	am->bits = bits;
 	am->channels = channels;
+	am->render_fs = render_fs > 0 ? render_fs : fs;
+	am->render_bits = bits;
+
+	// renderers running at another rate render float for the resampler
+	if (am->render_fs != fs) {
+		am->render_bits = SAMPLE_F32;
+		am->rs = Resampler_Create(am->render_fs, fs, channels, quality,
+		                          AM_RS_FRAMES);
+		am->rs_in = (float*) calloc(Resampler_MaxInput(am->rs) * channels,
+		                            sizeof(float));
+		am->rs_out = (float*) calloc(AM_RS_FRAMES * channels, sizeof(float));
+		assert(am->rs_in && am->rs_out);
+	}
+
+	atomic_store(&am->rs_ticks, 0);
+	atomic_store(&am->rs_frames, 0);
+	am->quality = 0;
+	am->gov_ticks = 0;
+	am->gov_frames = 0;
+	am->gov_low = 0;
 	am->running = true;
-	am->max_silence = fs * MODP_MAX_SILENCE_MS / 1000;
+	SilenceDetector_Init(&am->sd, fs, bits, channels, MODP_SILENCE_DB,
+	                     MODP_SILENCE_HYST_DB, MODP_MAX_SILENCE_MS);
 
 	atomic_store(&am->rt_msg, RTM_NONE);
+	atomic_store(&am->active, AM_SLOT_NONE);
+	atomic_store(&am->rendering, AM_SLOT_NONE);
+	atomic_store(&am->track_req, -1);
+	atomic_store(&am->seek_req, -1);
+	atomic_store(&am->underruns, 0);
+	atomic_store(&am->next, AM_SLOT_NONE);
+	atomic_store(&am->preload_gen, 0);
+	atomic_store(&am->adv_msg, RTM_NONE);
+	atomic_store(&am->auto_advance, false);
+	atomic_store(&am->auto_subtrack, false);
+	am->preloading = AM_SLOT_NONE;
+
+	am->ars = AudioManager_CreateRenderers(am->render_fs, am->render_bits,
+	                                       channels);
+
+	am->now.active = AM_SLOT_NONE;
+	am->now.track = -1;
 
-	PortAudio_Init(am);
-#ifdef HAVE_OPENMPT
-	am->ars = (AudioRenderer**) calloc(6, sizeof(AudioRenderer*));
-#else
-	am->ars = (AudioRenderer**) calloc(5, sizeof(AudioRenderer*));
-#endif
-	assert(am->ars);
+	am->mutex = SDL_CreateMutex();
+	assert(am->mutex);
+	am->now_mutex = SDL_CreateMutex();
+	assert(am->now_mutex);
 
-	am->ars[0] = SIDRenderer_Create(fs, bits, channels);
-	am->ars[1] = XMPRenderer_Create(fs, bits, channels);
-	am->ars[2] = HVLRenderer_Create(fs, bits, channels);
-	am->ars[3] = GMERenderer_Create(fs, bits, channels);
-#ifndef HAVE_OPENMPT
-	am->ars[4] = NULL;
-#else
-	am->ars[4] = OpenMPTRenderer_Create(fs, bits, channels);
-	am->ars[5] = NULL;
-#endif
+	return am;
+}
 
-	am->active_ar = am->ars[0];
+// render_fs is the rate the renderers run at, 0 for the output rate.
+AudioManager*
+AudioManager_CreateOffline(int fs,
+                           int bits,
+                           int channels,
+                           int render_fs,
+                           Resampler_Quality quality)
+{
+	if (!AudioManager_ValidFormat(fs, bits, channels, render_fs))
+		return NULL;
+
+	// no output stream, ring buffers or render thread, renderers are
+	// driven directly by AudioManager_RenderToFile
+	return AudioManager_Alloc(fs, bits, channels, render_fs, quality);
+}
+
+AudioManager*
+AudioManager_Create(int fs,
+                    int bits,
+                    int channels,
+                    int render_fs,
+                    Resampler_Quality quality,
+                    const char* output)
+{
+	AudioManager* am;
+
+	if (!AudioManager_ValidFormat(fs, bits, channels, render_fs))
+		return NULL;
+
+	am = AudioManager_Alloc(fs, bits, channels, render_fs, quality);
+
+	for (int i = 0; i < MODP_AM_SLOTS; i++)
+		am->slots[i].ars = AudioManager_CreateRenderers(am->render_fs,
+		                                                am->render_bits,
+		                                                channels);
+
+	am->out = AudioManager_CreateOutput(am, output);
+
+	if (am->out == NULL) {
+		AudioManager_Destroy(am);
+		return NULL;
+	}
 
 	// TODO: Fix buffer sizes and set them to sane values
-	am->render_buf = RingBuffer_Create(MODP_RNDR_BUF_SEC * fs * channels, 2);
-	am->playback_buf = RingBuffer_Create(fs / 16, 2);
+	am->render_buf = RingBuffer_Create(MODP_RNDR_BUF_SEC * fs * channels,
+	                                   Sample_Bytes(bits));
+	am->playback_buf = RingBuffer_Create(fs / 16, sizeof(float));
 
-	am->mutex = SDL_CreateMutex();
-	assert(am->mutex);
 	am->sem = SDL_CreateSemaphore(0);
 	assert(am->sem);
 	am->thread = SDL_CreateThread(RenderThread, NULL, (void*) am);
 	assert(am->thread);
 
+	am->preload_sem = SDL_CreateSemaphore(0);
+	assert(am->preload_sem);
+	am->preload_mutex = SDL_CreateMutex();
+	assert(am->preload_mutex);
+	am->preload_thread = SDL_CreateThread(PreloadThread, NULL, (void*) am);
+	assert(am->preload_thread);
+
 	return am;
 }
@@ -7,10 +7,13 @@
 #include <stdatomic.h>
 
 #include <SDL2/SDL_thread.h>
-#include <portaudio.h>
 
 #include "RingBuffer.h"
 #include "AudioRenderer.h"
+#include "AudioOutput.h"
+#include "Resampler.h"
+#include "SilenceDetector.h"
+#include "Globals.h"
 
 typedef enum CallbackMessage {
 	CBM_NONE,
@@ -19,16 +22,85 @@ typedef enum CallbackMessage {
 
 typedef enum RenderThreadMessage {
 	RTM_NONE,
-	RTM_AUTO_INC
+	RTM_AUTO_INC,
+	RTM_ADV_TRACK,
+	RTM_ADV_NEXT
 } RenderThreadMessage;
 
+// Renderers are loaded into slots, each slot holding its own instance of
+// every renderer. A control operation loads into a slot that is neither
+// published nor being rendered, then publishes it by swapping the active
+// word, which carries the slot index in its low bits and a generation
+// count above them. The render thread announces the slot it is rendering
+// in rendering, so a slot is only reused once it has let go of it.
+//
+// One more slot holds the next file, loaded in the background by the
+// preload thread and published in next. At the end of a track the render
+// thread switches to it between two samples of the same ring.
+#define MODP_AM_SLOTS     (4)
+#define AM_SLOT_NONE      (0xff)
+#define AM_SLOT(v)        ((int) ((v) & 0xff))
+#define AM_GEN(v)         ((v) >> 8)
+
+#define AM_MAX_RENDERERS  (8)
+#define AM_RS_FRAMES      (512)
+// how far renderers without a fast seek get per pass of the render thread
+#define AM_SEEK_STEP_MS   (1000)
+// the quality governor measures render time against real time over this
+// much audio, steps the quality down above AM_GOV_HIGH, and back up after
+// AM_GOV_UP_WINDOWS windows in a row below AM_GOV_LOW
+#define AM_GOV_WINDOW_MS  (500)
+#define AM_GOV_HIGH       (0.7)
+#define AM_GOV_LOW        (0.3)
+#define AM_GOV_UP_WINDOWS (4)
+
+typedef struct AudioManager_Slot {
+	AudioRenderer** ars;
+	AudioRenderer* ar;
+	// frames rendered since the track started, whether the track is to be
+	// moved on from as it fell silent or ended, and whether the renderer
+	// reported its end, owned by the render thread
+	size_t frames;
+	bool silent;
+	bool ended;
+} AudioManager_Slot;
+
+// What the UI is shown of the published renderer. It is taken down by the
+// thread owning the renderer, when it is published and after every render
+// pass, subtrack change or seek, so the UI never calls into a renderer the
+// render thread may be running.
+typedef struct AudioManager_NowPlaying {
+	// the active word this describes
+	unsigned int active;
+	bool loaded;
+	char title[MODP_STR_LENGTH];
+	char info[MODP_STR_LENGTH];
+	int track,
+	    ntracks;
+	// in seconds
+	int play_time,
+	    length;
+} AudioManager_NowPlaying;
+
+typedef struct AudioManager_PreloadReq {
+	char filename[MODP_STR_LENGTH];
+	void* data;
+	size_t len;
+	void (*free_data)(void*, size_t);
+	// the active word the prediction was made for, and preload_gen then
+	unsigned int base,
+	             gen;
+} AudioManager_PreloadReq;
+
 typedef struct AudioManager {
-	// render_buf is fed samples which are fetched by PortAudio
+	// render_buf is fed samples which are fetched by the output
 	RingBuffer* render_buf;
 	// playback_buf is only intended to be used for visualization
 	RingBuffer* playback_buf;
 
 	_Atomic CallbackMessage cb_msg;
+	// render_buf position the callback skips to at CBM_CLR_BUF
+	_Atomic unsigned int clr_pos;
 	SDL_Thread* thread;
 	SDL_mutex* mutex;
 	SDL_sem* sem;
@@ -37,27 +109,141 @@ typedef struct AudioManager {
 	_Atomic bool running,
 	             playing;
 
-	AudioRenderer* active_ar;
+	// ars are only used for probing
 	AudioRenderer** ars;
 	int fs, bits, channels;
 
+	// renderers run at render_fs, in render_bits, and are resampled to
+	// the output rate by rs when that differs
+	int render_fs, render_bits;
+	Resampler* rs;
+	float* rs_in;
+	float* rs_out;
+	// performance counter ticks spent resampling, and frames produced
+	_Atomic uint64_t rs_ticks,
+	                 rs_frames;
+
+	// the quality level the renderers are asked for, and the render time
+	// of the current window, owned by the render thread
+	int quality;
+	uint64_t gov_ticks;
+	size_t gov_frames;
+	int gov_low;
+
+	AudioManager_Slot slots[MODP_AM_SLOTS];
+	_Atomic unsigned int active;
+	// what the UI is shown of the active slot, under now_mutex
+	AudioManager_NowPlaying now;
+	SDL_mutex* now_mutex;
+	_Atomic int rendering;
+	// subtrack change to be applied by the render thread, -1 if none
+	_Atomic int track_req;
+	// position in ms the render thread is seeking to, -1 if none, only
+	// cleared once it is reached
+	_Atomic int seek_req;
+
+	// slot loaded with the next file, and the slot the preload thread
+	// is loading into, both AM_SLOT_NONE if none
+	_Atomic unsigned int next;
+	int preloading;
+	SDL_Thread* preload_thread;
+	SDL_sem* preload_sem;
+	SDL_mutex* preload_mutex;
+	AudioManager_PreloadReq preload_req;
+	// bumped when the predictions made so far no longer hold
+	_Atomic unsigned int preload_gen;
+
+	// whether the render thread moves on by itself at the end of a track,
+	// and if it may do so to the next subtrack
+	_Atomic bool auto_advance,
+	             auto_subtrack;
+	_Atomic RenderThreadMessage adv_msg;
+
+	// run on every rendered block by the render thread, silence_at is
+	// the frame of the track the last reported silence began at
+	SilenceDetector sd;
 	_Atomic RenderThreadMessage rt_msg;
-	size_t max_silence;
+	_Atomic size_t silence_at;
 
-	PaStream* stream;
-	PaError pa_err;
+	AudioOutput* out;
+	// times the output asked for more than render_buf held
+	_Atomic unsigned int underruns;
+	bool cb_fed;
 } AudioManager;
 
-AudioManager*  AudioManager_Create(int, int, int);
+typedef struct AudioManager_RenderStats {
+	size_t frames;
+	double seconds,
+	       elapsed;
+} AudioManager_RenderStats;
+
+typedef struct AudioManager_ResamplerStats {
+	const char* quality;
+	const char* isa;
+	int in_fs,
+	    out_fs;
+	// seconds of processing per second of audio
+	double cost;
+} AudioManager_ResamplerStats;
+
+typedef struct AudioManager_OutputStats {
+	const char* name;
+	double latency;
+	unsigned int underruns,
+	             xruns;
+} AudioManager_OutputStats;
+
+AudioManager*  AudioManager_Create(int,
+                                   int,
+                                   int,
+                                   int,
+                                   Resampler_Quality,
+                                   const char*);
+AudioManager*  AudioManager_CreateOffline(int,
+                                          int,
+                                          int,
+                                          int,
+                                          Resampler_Quality);
 void           AudioManager_Destroy(AudioManager*);
-AudioRenderer* AudioManager_CanLoad(AudioManager*, void*, size_t);
+AudioRenderer* AudioManager_CanLoad(AudioManager*,
+                                    const char*,
+                                    void*,
+                                    size_t,
+                                    void**);
 int            AudioManager_Load(AudioManager*,
                                  AudioRenderer*,
+                                 void*,
                                  const char*,
                                  void*,
                                  size_t);
 void           AudioManager_PlayPause(AudioManager*);
 bool           AudioManager_AlterSubTrack(AudioManager*, int);
-bool           AudioManager_SilenceDetected(AudioManager*);
+bool           AudioManager_Seek(AudioManager*, int);
+bool           AudioManager_TrackPending(AudioManager*);
+bool           AudioManager_SilenceDetected(AudioManager*, size_t*);
+void           AudioManager_SetSilence(AudioManager*, float, float, int);
+void           AudioManager_Preload(AudioManager*,
+                                    const char*,
+                                    void*,
+                                    size_t,
+                                    void (*)(void*, size_t));
+void           AudioManager_CancelPreload(AudioManager*);
+void           AudioManager_SetAutoAdvance(AudioManager*, bool, bool);
+bool           AudioManager_GaplessReady(AudioManager*);
+bool           AudioManager_Loaded(AudioManager*);
+void           AudioManager_GetNowPlaying(AudioManager*,
+                                          AudioManager_NowPlaying*);
+RenderThreadMessage AudioManager_Advanced(AudioManager*);
+void           AudioManager_GetOutputStats(AudioManager*,
+                                           AudioManager_OutputStats*);
+bool           AudioManager_GetResamplerStats(AudioManager*,
+                                              AudioManager_ResamplerStats*);
+int            AudioManager_RenderToFile(AudioManager*,
+                                         const char*,
+                                         void*,
+                                         size_t,
+                                         const char*,
+                                         int,
+                                         AudioManager_RenderStats*);
 
 #endif /* SRC_AUDIOMANAGER_H_ */
@@ -0,0 +1,91 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef AUDIOOUTPUT_H_
+#define AUDIOOUTPUT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <assert.h>
+
+typedef struct AudioOutput AudioOutput;
+typedef struct AudioOutput_VTable AudioOutput_VTable;
+
+// Called by the output, on its own thread, whenever it needs frames
+// interleaved samples. The callback must always fill the whole buffer.
+typedef void (*AudioOutput_Callback) (void*, unsigned long, void*);
+
+struct AudioOutput {
+	AudioOutput_VTable* vtable;
+	void* data;
+};
+
+struct AudioOutput_VTable {
+	int          (*Start)   (const AudioOutput*);
+	int          (*Stop)    (const AudioOutput*);
+	bool         (*Active)  (const AudioOutput*);
+	// seconds from a sample being pulled until it is heard
+	double       (*Latency) (const AudioOutput*);
+	// underruns reported by the device itself
+	unsigned int (*XRuns)   (const AudioOutput*);
+	const char*  (*Name)    (const AudioOutput*);
+	void         (*Destroy) (AudioOutput*);
+};
+
+static int
+AudioOutput_Start(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Start(obj);
+}
+
+static int
+AudioOutput_Stop(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Stop(obj);
+}
+
+static bool
+AudioOutput_Active(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Active(obj);
+}
+
+static double
+AudioOutput_Latency(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Latency(obj);
+}
+
+static unsigned int
+AudioOutput_XRuns(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return obj->vtable->XRuns(obj);
+}
+
+static const char*
+AudioOutput_Name(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Name(obj);
+}
+
+static void
+AudioOutput_Destroy(AudioOutput* obj)
+{
+	assert(obj);
+
+	obj->vtable->Destroy(obj);
+}
+
+#endif
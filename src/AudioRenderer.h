@@ -11,6 +11,25 @@
 typedef struct AudioRenderer AudioRenderer;
 typedef struct AudioRenderer_VTable AudioRenderer_VTable;
 
+// How sure a signature alone is about the format, a full CanLoad is only
+// needed below ARC_CERTAIN. A weak signature together with a matching
+// extension counts as certain.
+typedef enum AudioRenderer_Confidence {
+	ARC_NONE,
+	ARC_EXT,
+	ARC_WEAK,
+	ARC_CERTAIN
+} AudioRenderer_Confidence;
+
+// Either len bytes of magic at ofs in the file, or a file extension
+// without the dot. Tables end with an entry where both are NULL.
+typedef struct AudioRenderer_Sig {
+	const char* magic;
+	size_t ofs, len;
+	const char* ext;
+	AudioRenderer_Confidence conf;
+} AudioRenderer_Sig;
+
 struct AudioRenderer {
 	AudioRenderer_VTable* vtable;
 	void* data;
@@ -20,10 +39,13 @@ struct AudioRenderer_VTable {
 	int         (*Load)     (const AudioRenderer*,
 	                         const char*,
 	                         const void*,
-	                         const size_t);
+	                         const size_t,
+	                         void*);
 	bool        (*CanLoad)  (const AudioRenderer*,
 	                         const void*,
-	                         const size_t);
+	                         const size_t,
+	                         void**);
+	const AudioRenderer_Sig* (*Sigs) (const AudioRenderer*);
 	bool        (*Loaded)   (const AudioRenderer*);
 	void        (*UnLoad)   (const AudioRenderer*);
 	int         (*Render)   (const AudioRenderer*,
@@ -36,28 +58,54 @@ struct AudioRenderer_VTable {
 	int         (*SetTrack) (const AudioRenderer*, int);
 	int         (*PlayTime) (const AudioRenderer*);
 	int         (*Length)   (const AudioRenderer*);
+	bool        (*Ended)    (const AudioRenderer*);
+	int         (*Seek)     (const AudioRenderer*, int);
+	bool        (*CanSeekFast) (const AudioRenderer*);
+	int         (*SetQuality) (const AudioRenderer*, int);
 	void        (*Destroy)  (AudioRenderer*);
 };
 
+// prepared is what CanLoad of the same kind of renderer handed out for
+// data, or NULL. Load always takes it over, also when it fails, so every
+// prepared load is to be passed on to Load.
 static int
 AudioRenderer_Load(const AudioRenderer* obj,
                    const char* filename,
                    const void* data,
-                   const size_t len)
+                   const size_t len,
+                   void* prepared)
 {
 	assert(obj);
 
-	return obj->vtable->Load(obj, filename, data, len);
+	return obj->vtable->Load(obj, filename, data, len, prepared);
 }
 
+// A renderer that had to open the file to tell may keep what it opened in
+// prepared, for Load to take over rather than open it again.
 static bool
 AudioRenderer_CanLoad(const AudioRenderer* obj,
                       const void* data,
-                      const size_t len)
+                      const size_t len,
+                      void** prepared)
 {
+	bool r;
+
 	assert(obj);
+	assert(prepared);
+
+	*prepared = NULL;
+	r = obj->vtable->CanLoad(obj, data, len, prepared);
+	assert(r || *prepared == NULL);
 
-	return obj->vtable->CanLoad(obj, data, len);
+	return r;
+}
+
+static const AudioRenderer_Sig*
+AudioRenderer_Sigs(const AudioRenderer* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Sigs(obj);
 }
 
 static bool
@@ -142,6 +190,50 @@ AudioRenderer_Length(const AudioRenderer* obj)
 	return obj->vtable->Length(obj);
 }
 
+// Whether the current track has played out, renderers that know where a
+// track ends without a length tell it here. Nothing after the end is worth
+// rendering.
+static bool
+AudioRenderer_Ended(const AudioRenderer* obj)
+{
+	assert(obj);
+
+	return obj->vtable->Ended(obj);
+}
+
+// Moves the current track to ms from its start, and returns the position
+// reached in ms, or -1 if the renderer could not seek.
+static int
+AudioRenderer_Seek(const AudioRenderer* obj, int ms)
+{
+	assert(obj);
+	assert(ms >= 0);
+
+	return obj->vtable->Seek(obj, ms);
+}
+
+// Whether a seek costs the same however far it goes, renderers without a
+// native seek render up to the position and discard the audio.
+static bool
+AudioRenderer_CanSeekFast(const AudioRenderer* obj)
+{
+	assert(obj);
+
+	return obj->vtable->CanSeekFast(obj);
+}
+
+// Trades sound for render time, level 0 is the best and every level up is
+// cheaper. Returns the level in effect, below level when the renderer has
+// nothing cheaper.
+static int
+AudioRenderer_SetQuality(const AudioRenderer* obj, int level)
+{
+	assert(obj);
+	assert(level >= 0);
+
+	return obj->vtable->SetQuality(obj, level);
+}
+
 static void
 AudioRenderer_Destroy(AudioRenderer* obj)
 {
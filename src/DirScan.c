@@ -0,0 +1,221 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DirScan.h"
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// enough for a few hundred names per call
+#define DIRSCAN_BUF (32 * 1024)
+
+// the record getdents64 fills in
+typedef struct DirScan_Dirent {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} DirScan_Dirent;
+
+struct DirScan {
+	int fd;
+	long len,
+	     pos;
+	char buf[DIRSCAN_BUF] __attribute__ ((aligned(8)));
+};
+
+static DirScan*
+DirScan_FromFd(int fd)
+{
+	DirScan* ds;
+
+	if (fd < 0)
+		return NULL;
+
+	ds = (DirScan*) malloc(sizeof(DirScan));
+	assert(ds);
+
+	ds->fd = fd;
+	ds->len = ds->pos = 0;
+
+	return ds;
+}
+
+DirScan*
+DirScan_Open(const char* path)
+{
+	assert(path);
+
+	return DirScan_FromFd(open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+}
+
+// Opens the directory name in the directory ds reads, without building
+// its path, for scanners that walk a tree.
+DirScan*
+DirScan_OpenAt(const DirScan* ds,
+               const char* name)
+{
+	assert(ds);
+	assert(name);
+
+	return DirScan_FromFd(openat(ds->fd, name,
+	                             O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+}
+
+// The next name, valid until the next call, or NULL at the end or on an
+// error.
+const char*
+DirScan_Next(DirScan* ds,
+             DirScan_Type* type)
+{
+	assert(ds);
+	assert(type);
+
+	for (;;) {
+		const DirScan_Dirent* d;
+		struct stat st;
+
+		if (ds->pos >= ds->len) {
+			ds->len = syscall(SYS_getdents64, ds->fd, ds->buf, sizeof(ds->buf));
+			ds->pos = 0;
+
+			if (ds->len <= 0)
+				return NULL;
+		}
+
+		d = (const DirScan_Dirent*) (ds->buf + ds->pos);
+		ds->pos += d->d_reclen;
+
+		if (d->d_name[0] == '.' && (d->d_name[1] == '\0'
+		        || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+			continue;
+
+		switch (d->d_type) {
+			case DT_DIR:
+				*type = DS_DIR;
+				break;
+			case DT_REG:
+				*type = DS_REG;
+				break;
+			case DT_UNKNOWN:
+				// gone since, most likely
+				if (fstatat(ds->fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;
+
+				*type = S_ISDIR(st.st_mode) ? DS_DIR
+				        : S_ISREG(st.st_mode) ? DS_REG
+				        : DS_OTHER;
+				break;
+			default:
+				*type = DS_OTHER;
+				break;
+		}
+
+		return d->d_name;
+	}
+}
+
+void
+DirScan_Close(DirScan* ds)
+{
+	if (ds == NULL)
+		return;
+
+	close(ds->fd);
+	free(ds);
+}
+
+#else
+
+#include <tinydir.h>
+
+struct DirScan {
+	tinydir_dir dir;
+	tinydir_file f;
+};
+
+DirScan*
+DirScan_Open(const char* path)
+{
+	DirScan* ds;
+
+	assert(path);
+
+	ds = (DirScan*) malloc(sizeof(DirScan));
+	assert(ds);
+
+	if (tinydir_open(&ds->dir, path) == -1) {
+		free(ds);
+		return NULL;
+	}
+
+	return ds;
+}
+
+DirScan*
+DirScan_OpenAt(const DirScan* ds,
+               const char* name)
+{
+	char path[_TINYDIR_PATH_MAX];
+
+	assert(ds);
+	assert(name);
+
+	if (snprintf(path, sizeof(path), "%s/%s", ds->dir.path, name)
+	        >= (int) sizeof(path))
+		return NULL;
+
+	return DirScan_Open(path);
+}
+
+const char*
+DirScan_Next(DirScan* ds,
+             DirScan_Type* type)
+{
+	assert(ds);
+	assert(type);
+
+	while (ds->dir.has_next) {
+		int r = tinydir_readfile(&ds->dir, &ds->f);
+
+		if (tinydir_next(&ds->dir) == -1)
+			return NULL;
+
+		// too long a name, or gone since
+		if (r == -1)
+			continue;
+
+		if (strcmp(ds->f.name, ".") == 0 || strcmp(ds->f.name, "..") == 0)
+			continue;
+
+		*type = ds->f.is_dir ? DS_DIR : ds->f.is_reg ? DS_REG : DS_OTHER;
+
+		return ds->f.name;
+	}
+
+	return NULL;
+}
+
+void
+DirScan_Close(DirScan* ds)
+{
+	if (ds == NULL)
+		return;
+
+	tinydir_close(&ds->dir);
+	free(ds);
+}
+
+#endif
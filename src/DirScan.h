@@ -0,0 +1,24 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_DIRSCAN_H_
+#define SRC_DIRSCAN_H_
+
+typedef enum DirScan_Type {
+	DS_OTHER,
+	DS_DIR,
+	DS_REG
+} DirScan_Type;
+
+// Reads the names in a directory, and whether each is a directory, a
+// regular file or something else, as lstat would tell. On Linux the
+// types come with the names, and only filesystems that leave them out
+// cost a stat per name. "." and ".." are left out.
+typedef struct DirScan DirScan;
+
+DirScan*    DirScan_Open   (const char*);
+DirScan*    DirScan_OpenAt (const DirScan*, const char*);
+const char* DirScan_Next   (DirScan*, DirScan_Type*);
+void        DirScan_Close  (DirScan*);
+
+#endif /* SRC_DIRSCAN_H_ */
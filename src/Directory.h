@@ -18,6 +18,7 @@ typedef struct Directory {
 struct Directory_VTable {
 	int         (*LoadDir)   (const Directory*,
 	                          size_t);
+	bool        (*Update)    (const Directory*, int*, size_t);
 	size_t      (*SubDirIdx) (const Directory*);
 	size_t      (*NDirs)     (const Directory*);
 	size_t      (*NFiles)    (const Directory*);
@@ -25,6 +26,7 @@ struct Directory_VTable {
 	const char* (*GetName)   (const Directory*, size_t, bool*);
 	void        (*FullPath)  (const Directory*, char*, size_t);
 	void*       (*GetFile)   (const Directory*, size_t, size_t*, size_t);
+	void        (*FreeFile)  (void*, size_t);
 	void        (*Print)     (const Directory*);
 	void        (*PrintTree) (const Directory*);
 	void        (*Destroy)   (Directory*);
@@ -39,6 +41,21 @@ Directory_LoadDir(const Directory* obj,
 	return obj->vtable->LoadDir(obj, idx);
 }
 
+// Takes in what has been read of the current directory since the last
+// call. The listing stays sorted, so entries can move; the n_ofs offsets
+// in ofs are moved along with the entries they point at. Returns true
+// while there is more to come.
+static bool
+Directory_Update(const Directory* obj,
+                 int* ofs,
+                 size_t n_ofs)
+{
+	assert(obj);
+	assert(ofs || n_ofs == 0);
+
+	return obj->vtable->Update(obj, ofs, n_ofs);
+}
+
 static size_t
 Directory_SubDirIdx(const Directory* obj)
 {
@@ -102,6 +119,18 @@ Directory_GetFile(const Directory* obj,
 	return obj->vtable->GetFile(obj, idx, len, max_len);
 }
 
+// Releases a file GetFile returned. The file may be mapped read only, and
+// FreeFile needs no Directory, so whoever ends up with it can release it.
+static void
+Directory_FreeFile(const Directory* obj,
+                   void* data,
+                   size_t len)
+{
+	assert(obj);
+
+	obj->vtable->FreeFile(data, len);
+}
+
 static void
 Directory_Print(const Directory* obj)
 {
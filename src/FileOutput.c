@@ -0,0 +1,235 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_timer.h>
+
+#include "FileOutput.h"
+#include "WavFile.h"
+#include "Globals.h"
+
+// A sink clocked by the system timer instead of a sound card. It pulls a
+// period of MODP_OUT_FRAMES every period, and writes it to a WAV or raw
+// file, or nowhere at all for the null sink.
+typedef struct FileOutput_Data {
+	FileOutput_Format fmt;
+	WavFile* wf;
+	FILE* f;
+	void* period;
+
+	SDL_Thread* thread;
+	_Atomic bool running;
+
+	AudioOutput_Callback cb;
+	void* user;
+	_Atomic unsigned int xruns;
+	int fs, bits, channels;
+} FileOutput_Data;
+
+#define DataObject(a, b) \
+	FileOutput_Data* (a) = (FileOutput_Data*) (b)->data; \
+	assert((a)); \
+	DebugPrint((b));
+
+static int
+FileOutput_Thread(void* data)
+{
+	FileOutput_Data* out_data = (FileOutput_Data*) data;
+	size_t period_bytes = MODP_OUT_FRAMES * out_data->channels * out_data->bits / 8;
+	Uint64 freq = SDL_GetPerformanceFrequency();
+	Uint64 t_start = SDL_GetPerformanceCounter();
+	Uint64 periods = 0;
+
+	while (atomic_load(&out_data->running)) {
+		Uint64 t_due, t_now;
+
+		out_data->cb(out_data->period, MODP_OUT_FRAMES, out_data->user);
+
+		if (out_data->fmt == FOF_WAV)
+			WavFile_Write(out_data->wf, out_data->period, period_bytes);
+		else if (out_data->fmt == FOF_RAW)
+			fwrite(out_data->period, 1, period_bytes, out_data->f);
+
+		periods++;
+
+		t_due = t_start + periods * MODP_OUT_FRAMES * freq / out_data->fs;
+		t_now = SDL_GetPerformanceCounter();
+
+		// a device would have run dry here, restart the clock like one
+		// recovering from an underrun instead of bursting to catch up
+		if (t_now > t_due + MODP_OUT_FRAMES * freq / out_data->fs) {
+			atomic_fetch_add(&out_data->xruns, 1);
+			t_start = t_now;
+			periods = 0;
+			continue;
+		}
+
+		while (t_now < t_due && atomic_load(&out_data->running)) {
+			Uint64 ms = (t_due - t_now) * 1000 / freq;
+
+			SDL_Delay(ms > 0 ? ms : 1);
+			t_now = SDL_GetPerformanceCounter();
+		}
+	}
+
+	return 0;
+}
+
+static int
+FileOutput_Start(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	if (out_data->thread != NULL)
+		return 0;
+
+	atomic_store(&out_data->running, true);
+
+	out_data->thread = SDL_CreateThread(FileOutput_Thread,
+	                                    NULL,
+	                                    (void*) out_data);
+	assert(out_data->thread);
+
+	return 0;
+}
+
+static int
+FileOutput_Stop(const AudioOutput* obj)
+{
+	int status;
+
+	DataObject(out_data, obj);
+
+	if (out_data->thread == NULL)
+		return 0;
+
+	atomic_store(&out_data->running, false);
+	SDL_WaitThread(out_data->thread, &status);
+	out_data->thread = NULL;
+
+	return 0;
+}
+
+static bool
+FileOutput_Active(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	return out_data->thread != NULL;
+}
+
+static double
+FileOutput_Latency(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	// a period is pulled when it starts "playing"
+	return (double) MODP_OUT_FRAMES / out_data->fs;
+}
+
+static unsigned int
+FileOutput_XRuns(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	return atomic_load(&out_data->xruns);
+}
+
+static const char*
+FileOutput_Name(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	switch (out_data->fmt) {
+		case FOF_WAV:
+			return "wav";
+		case FOF_RAW:
+			return "raw";
+		default:
+			return "null";
+	}
+}
+
+static void
+FileOutput_Destroy(AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	FileOutput_Stop(obj);
+
+	if (out_data->wf != NULL)
+		WavFile_Close(out_data->wf);
+
+	if (out_data->f != NULL)
+		fclose(out_data->f);
+
+	free(out_data->period);
+	free(out_data);
+	free(obj);
+}
+
+AudioOutput*
+FileOutput_Create(FileOutput_Format fmt, const char* path,
+                  int fs, int bits, int channels,
+                  AudioOutput_Callback cb, void* user)
+{
+	AudioOutput* aout;
+	FileOutput_Data* out_data;
+	static AudioOutput_VTable _vtable;
+	static bool _initialized = false;
+
+	if (!_initialized) {
+		memset((void*) &_vtable, 0, sizeof(AudioOutput_VTable));
+
+		_vtable.Start   = (*FileOutput_Start);
+		_vtable.Stop    = (*FileOutput_Stop);
+		_vtable.Active  = (*FileOutput_Active);
+		_vtable.Latency = (*FileOutput_Latency);
+		_vtable.XRuns   = (*FileOutput_XRuns);
+		_vtable.Name    = (*FileOutput_Name);
+		_vtable.Destroy = (*FileOutput_Destroy);
+
+		_initialized = true;
+	}
+
+	out_data = (FileOutput_Data*) calloc(1, sizeof(FileOutput_Data));
+	assert(out_data);
+
+	out_data->fmt = fmt;
+	out_data->cb = cb;
+	out_data->user = user;
+	out_data->fs = fs;
+	out_data->bits = bits;
+	out_data->channels = channels;
+	atomic_init(&out_data->running, false);
+	atomic_init(&out_data->xruns, 0);
+
+	if (fmt == FOF_WAV)
+		out_data->wf = WavFile_Open(path, fs, bits, channels);
+	else if (fmt == FOF_RAW)
+		out_data->f = fopen(path, "wb");
+
+	if ((fmt == FOF_WAV && out_data->wf == NULL)
+	        || (fmt == FOF_RAW && out_data->f == NULL)) {
+		fprintf(stderr, "FileOutput: %s: could not open for writing\n", path);
+		free(out_data);
+		return NULL;
+	}
+
+	out_data->period = calloc(MODP_OUT_FRAMES, channels * bits / 8);
+	assert(out_data->period);
+
+	aout = (AudioOutput*) calloc(1, sizeof(AudioOutput));
+	assert(aout);
+
+	aout->vtable = &_vtable;
+	aout->data = (void*) out_data;
+
+	return aout;
+}
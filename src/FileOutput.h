@@ -0,0 +1,19 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef FILEOUTPUT_H_
+#define FILEOUTPUT_H_
+
+#include "AudioOutput.h"
+
+typedef enum FileOutput_Format {
+	FOF_NULL,
+	FOF_WAV,
+	FOF_RAW
+} FileOutput_Format;
+
+AudioOutput* FileOutput_Create(FileOutput_Format, const char*,
+                               int, int, int,
+                               AudioOutput_Callback, void*);
+
+#endif /* FILEOUTPUT_H_ */
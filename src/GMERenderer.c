@@ -11,9 +11,15 @@
 
 #include "HCS64File.h"
 #include "GMERenderer.h"
+#include "Sample.h"
+#include "MinMax.h"
 #include "Globals.h"
 
 #define GME_TRACK_LENGTH 90000
+// how long gme takes to fade a track out, it ends when the fade is done
+#define GME_FADE_MS 8000
+// the accurate emulation, and the default one
+#define GME_QUALITIES 2
 
 typedef struct GMERenderer_Data {
 	Music_Emu* emu;
@@ -22,6 +28,7 @@ typedef struct GMERenderer_Data {
 	char info[MODP_STR_LENGTH];
 	int current_track;
 	int track_length;
+	int quality;
 	int fs, bits, channels;
 } GMERenderer_Data;
 
@@ -33,45 +40,38 @@ typedef struct GMERenderer_Data {
 static void GMERenderer_UnLoad(const AudioRenderer*);
 static int  GMERenderer_SetTrack(const AudioRenderer*, int);
 
-static int
-GMERenderer_Load(const AudioRenderer* obj,
-                 const char* filename,
-                 const void* data,
-                 const size_t len)
+// Opens data as a gme file, or as an HCS64 archive with the song and its
+// playlist extracted, emu is NULL on error.
+static gme_err_t
+GMERenderer_Open(const void* data,
+                 const size_t len,
+                 int fs,
+                 Music_Emu** emu)
 {
-	DataObject(rndr_data, obj);
-
-	rndr_data->err = gme_open_data(data, len, &rndr_data->emu, rndr_data->fs);
+	gme_err_t err = gme_open_data(data, len, emu, fs);
 
-	if (rndr_data->err != NULL) {
+	if (err != NULL) {
 		char* song;
 		size_t song_len;
 
 		char* m3u;
 		size_t m3u_len = 0;
 
-		gme_delete(rndr_data->emu);
-
 		if (TryOpenHCS64(data, len, &song, &song_len, &m3u, &m3u_len)) {
 load_song:
-			rndr_data->err = gme_open_data(song,
-			                               song_len,
-			                               &rndr_data->emu,
-			                               rndr_data->fs);
+			err = gme_open_data(song, song_len, emu, fs);
 
-			if (rndr_data->err != NULL) {
-				fprintf(stderr, "%s\n", rndr_data->err);
+			if (err != NULL) {
+				fprintf(stderr, "%s\n", err);
 			} else if (m3u_len > 0) {
-				rndr_data->err = gme_load_m3u_data(rndr_data->emu,
-				                                   m3u,
-				                                   m3u_len);
+				err = gme_load_m3u_data(*emu, m3u, m3u_len);
 
 				m3u_len = 0;
 				free(m3u);
 
-				if (rndr_data->err != NULL) {
-					fprintf(stderr, "%s\n", rndr_data->err);
-					gme_delete(rndr_data->emu);
+				if (err != NULL) {
+					fprintf(stderr, "%s\n", err);
+					gme_delete(*emu);
 					goto load_song;
 				}
 			}
@@ -80,54 +80,115 @@ load_song:
 		}
 	}
 
+	if (err != NULL)
+		*emu = NULL;
+
+	return err;
+}
+
+static int
+GMERenderer_Load(const AudioRenderer* obj,
+                 const char* filename,
+                 const void* data,
+                 const size_t len,
+                 void* prepared)
+{
+	DataObject(rndr_data, obj);
+
+	// a load replaces whatever was loaded before
+	GMERenderer_UnLoad(obj);
+
+	// the probe already opened it
+	if (prepared != NULL) {
+		rndr_data->emu = (Music_Emu*) prepared;
+		rndr_data->err = NULL;
+	} else {
+		rndr_data->err = GMERenderer_Open(data, len, rndr_data->fs,
+		                                  &rndr_data->emu);
+	}
+
+	// gme skips silence in the middle of a track, and ends a track that
+	// stays silent
+	if (rndr_data->err == NULL) {
+		gme_ignore_silence(rndr_data->emu, false);
+		gme_enable_accuracy(rndr_data->emu, rndr_data->quality == 0);
+	}
+
 	if (rndr_data->err == NULL)
 		assert(memccpy(rndr_data->title,
 		               filename,
 		               '\0',
 		               MODP_STR_LENGTH) != NULL);
 
-	return GMERenderer_SetTrack(obj, 0);
+	if (GMERenderer_SetTrack(obj, 0) < 0 || rndr_data->err != NULL) {
+		GMERenderer_UnLoad(obj);
+		return -1;
+	}
+
+	return 0;
 }
 
+// Telling a gme file, and above all an archive, apart takes opening it,
+// so the opened emulator is handed on to Load.
 static bool
 GMERenderer_CanLoad(const AudioRenderer* obj,
                     const void* data,
-                    const size_t len)
+                    const size_t len,
+                    void** prepared)
 {
 	DataObject(rndr_data, obj);
 
-	Music_Emu* tmp;
-
-	char* song = NULL;
-	size_t song_len;
-
-	char* m3u = NULL;
-	size_t m3u_len;
-
-	gme_err_t err;
-
-	err = gme_open_data(data, len, &tmp, rndr_data->fs);
-
-	gme_delete(tmp);
-
-	if (err == NULL)
-		return true;
+	Music_Emu* emu;
 
-	if (TryOpenHCS64(data, len, &song, &song_len, &m3u, &m3u_len)) {
-		err = gme_open_data(song, song_len, &tmp, rndr_data->fs);
+	if (GMERenderer_Open(data, len, rndr_data->fs, &emu) != NULL)
+		return false;
 
-		if (song != NULL)
-			free(song);
-		if (m3u != NULL)
-			free(m3u);
+	*prepared = emu;
 
-		gme_delete(tmp);
-	}
+	return true;
+}
 
-	if (err == NULL)
-		return true;
+// game music signatures, archives only point at the HCS64File path and
+// need a probe to know what they hold
+static const AudioRenderer_Sig GMERenderer_SigTable[] = {
+	{ "ZXAYEMUL", 0, 8, NULL, ARC_CERTAIN },
+	{ "GBS\x01", 0, 4, NULL, ARC_CERTAIN },
+	{ "GYMX", 0, 4, NULL, ARC_CERTAIN },
+	{ "HESM", 0, 4, NULL, ARC_CERTAIN },
+	{ "KSCC", 0, 4, NULL, ARC_CERTAIN },
+	{ "KSSX", 0, 4, NULL, ARC_CERTAIN },
+	{ "NESM\x1a", 0, 5, NULL, ARC_CERTAIN },
+	{ "NSFE", 0, 4, NULL, ARC_CERTAIN },
+	{ "SAP\x0d\x0a", 0, 5, NULL, ARC_CERTAIN },
+	{ "SNES-SPC700 Sound File Data", 0, 27, NULL, ARC_CERTAIN },
+	{ "Vgm ", 0, 4, NULL, ARC_CERTAIN },
+	{ "\x1f\x8b", 0, 2, NULL, ARC_WEAK },
+	{ "PK\x03\x04", 0, 4, NULL, ARC_WEAK },
+	{ "7z\xbc\xaf\x27\x1c", 0, 6, NULL, ARC_WEAK },
+	{ "Rar!\x1a\x07", 0, 6, NULL, ARC_WEAK },
+	{ NULL, 0, 0, "ay", ARC_EXT },
+	{ NULL, 0, 0, "gbs", ARC_EXT },
+	{ NULL, 0, 0, "gym", ARC_EXT },
+	{ NULL, 0, 0, "hes", ARC_EXT },
+	{ NULL, 0, 0, "kss", ARC_EXT },
+	{ NULL, 0, 0, "nsf", ARC_EXT },
+	{ NULL, 0, 0, "nsfe", ARC_EXT },
+	{ NULL, 0, 0, "sap", ARC_EXT },
+	{ NULL, 0, 0, "spc", ARC_EXT },
+	{ NULL, 0, 0, "vgm", ARC_EXT },
+	{ NULL, 0, 0, "vgz", ARC_EXT },
+	{ NULL, 0, 0, "rsn", ARC_EXT },
+	{ NULL, 0, 0, "7z", ARC_EXT },
+	{ NULL, 0, 0, "zip", ARC_EXT },
+	{ NULL, 0, 0, NULL, ARC_NONE }
+};
+
+static const AudioRenderer_Sig*
+GMERenderer_Sigs(const AudioRenderer* obj)
+{
+	(void) obj;
 
-	return false;
+	return GMERenderer_SigTable;
 }
 
 static bool
@@ -154,6 +215,17 @@ GMERenderer_UnLoad(const AudioRenderer* obj)
 	rndr_data->current_track = rndr_data->track_length = -1;
 }
 
+static void
+GMERenderer_RenderS16(void* user, int16_t* buf, size_t frames)
+{
+	GMERenderer_Data* rndr_data = (GMERenderer_Data*) user;
+
+	rndr_data->err = gme_play(rndr_data->emu, frames * 2, buf);
+
+	if (rndr_data->err != NULL)
+		fprintf(stderr, "%s\n", rndr_data->err);
+}
+
 static int
 GMERenderer_Render(const AudioRenderer* obj,
                    void* buf,
@@ -161,10 +233,11 @@ GMERenderer_Render(const AudioRenderer* obj,
 {
 	DataObject(rndr_data, obj);
 
-	rndr_data->err = gme_play(rndr_data->emu, len / sizeof(T), buf);
-
-	if (rndr_data->err != NULL)
-		fprintf(stderr, "%s\n", rndr_data->err);
+	// gme always plays int16 stereo
+	Sample_RenderS16(GMERenderer_RenderS16, rndr_data, 2,
+	                 buf, rndr_data->bits, rndr_data->channels,
+	                 len / Sample_FrameBytes(rndr_data->bits,
+	                                         rndr_data->channels));
 
 	return len;
 }
@@ -270,6 +343,10 @@ GMERenderer_SetTrack(const AudioRenderer* obj, int track)
 		else
 			rndr_data->track_length = GME_TRACK_LENGTH;
 
+		// faded out by the end of the length, where the track then ends
+		gme_set_fade(rndr_data->emu,
+		             max_int(rndr_data->track_length - GME_FADE_MS, 0));
+
 		songlen = strnlen(info->song, MODP_STR_LENGTH - 1);
 
 		if (songlen > 0)
@@ -314,6 +391,54 @@ GMERenderer_Length(const AudioRenderer* obj)
 	return rndr_data->track_length / 1000;
 }
 
+// gme ends a track after its fade, or once it has been silent for a while
+static bool
+GMERenderer_Ended(const AudioRenderer* obj)
+{
+	DataObject(rndr_data, obj);
+
+	return rndr_data->emu != NULL && gme_track_ended(rndr_data->emu);
+}
+
+static int
+GMERenderer_Seek(const AudioRenderer* obj, int ms)
+{
+	DataObject(rndr_data, obj);
+
+	if (rndr_data->emu == NULL)
+		return -1;
+
+	rndr_data->err = gme_seek(rndr_data->emu, ms);
+
+	if (rndr_data->err != NULL) {
+		fprintf(stderr, "%s\n", rndr_data->err);
+		return -1;
+	}
+
+	return gme_tell(rndr_data->emu);
+}
+
+static bool
+GMERenderer_CanSeekFast(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return false;
+}
+
+static int
+GMERenderer_SetQuality(const AudioRenderer* obj, int level)
+{
+	DataObject(rndr_data, obj);
+
+	rndr_data->quality = min_int(level, GME_QUALITIES - 1);
+
+	if (rndr_data->emu != NULL)
+		gme_enable_accuracy(rndr_data->emu, rndr_data->quality == 0);
+
+	return rndr_data->quality;
+}
+
 static void
 GMERenderer_Destroy(AudioRenderer* obj)
 {
@@ -339,6 +464,7 @@ GMERenderer_Create(int fs, int bits, int channels)
 
 		_vtable.Load     = (*GMERenderer_Load);
 		_vtable.CanLoad  = (*GMERenderer_CanLoad);
+		_vtable.Sigs     = (*GMERenderer_Sigs);
 		_vtable.Loaded   = (*GMERenderer_Loaded);
 		_vtable.UnLoad   = (*GMERenderer_UnLoad);
 		_vtable.Render   = (*GMERenderer_Render);
@@ -349,6 +475,10 @@ GMERenderer_Create(int fs, int bits, int channels)
 		_vtable.SetTrack = (*GMERenderer_SetTrack);
 		_vtable.PlayTime = (*GMERenderer_PlayTime);
 		_vtable.Length   = (*GMERenderer_Length);
+		_vtable.Ended    = (*GMERenderer_Ended);
+		_vtable.Seek     = (*GMERenderer_Seek);
+		_vtable.CanSeekFast = (*GMERenderer_CanSeekFast);
+		_vtable.SetQuality = (*GMERenderer_SetQuality);
 		_vtable.Destroy  = (*GMERenderer_Destroy);
 
 		_initialized = true;
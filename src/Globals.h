@@ -13,7 +13,14 @@
 #define MODP_STR_LENGTH      (1024)
 #define MODP_MAX_FILESIZE    (4 * 1024 * 1024)
 #define MODP_MAX_SILENCE_MS  (3000)
+#define MODP_SILENCE_DB      (-70.f)
+#define MODP_SILENCE_HYST_DB (6.f)
 #define MODP_RNDR_BUF_SEC    (1)
+#define MODP_CACHE_LINE      (64)
+#define MODP_OUT_FRAMES      (1536)
+#define MODP_PRELOAD_MS      (1000)
+#define MODP_SEEK_MS         (10000)
+#define MODP_SEEK_LONG_MS    (60000)
 
 #define DebugPrint(ptr) \
 	do { \
@@ -7,16 +7,22 @@
 
 #include "../3rdparty/hvl/hvl_replay.h"
 #include "HVLRenderer.h"
+#include "Sample.h"
+#include "MinMax.h"
 #include "Globals.h"
 
-#define HVL_FREQ 48000
-#define HIVELY_LEN HVL_FREQ/50
+// length scans give up after this, the song is taken to loop forever
+#define HVL_MAX_SCAN_SEC (60 * 60)
+
+// one replay frame at 50 Hz, the buffer holds a stereo frame at the
+// output rate
+#define HVL_FRAME_HZ 50
 
 typedef struct HVLRenderer_Data {
 	struct hvl_tune* hvl;
 	size_t hivelyIndex;
-	int16 hivelyLeft[HIVELY_LEN];
-	int16 hivelyRight[HIVELY_LEN];
+	size_t hivelyLen;
+	int16* hively;
 	char title[MODP_STR_LENGTH];
 	char info[MODP_STR_LENGTH];
 	_Atomic size_t total_frames_rendered;
@@ -39,23 +45,31 @@ HVLRenderer_LogFunc(const char* message, void* userdata)
 		fprintf(stderr, "HVLRenderer: %s\n", message);
 }
 
+// hvl_DecodeFrame mixes SpeedMultiplier chunks of a truncated length
+static size_t
+HVLRenderer_FrameLen(const struct hvl_tune* ht)
+{
+	return ht->ht_Frequency / HVL_FRAME_HZ / ht->ht_SpeedMultiplier
+	       * ht->ht_SpeedMultiplier;
+}
+
 static int
 HVLRenderer_Load(const AudioRenderer* obj,
                  const char* filename,
                  const void* data,
-                 const size_t len)
+                 const size_t len,
+                 void* prepared)
 {
     const char* hvl_str = NULL;
     const char* source = NULL;
     int i;
-    int8 b1[8][(HVL_FREQ*2*2)/50];
-    int8 b2[8][(HVL_FREQ*2*2)/50];
     size_t frames_total = 0;
-    int nb = 0;
+
+	(void) prepared;
 
 	DataObject(rndr_data, obj);
 
-	rndr_data->hvl = hvl_LoadData(data, len, HVL_FREQ, 4);
+	rndr_data->hvl = hvl_LoadData(data, len, rndr_data->fs, 4);
 
 	if (rndr_data->hvl == NULL)
 		return 1;
@@ -72,24 +86,25 @@ HVLRenderer_Load(const AudioRenderer* obj,
 	strcat(rndr_data->info, "\0");
 	assert(memccpy(rndr_data->title, source, '\0', MODP_STR_LENGTH) != NULL);
 
-	/* inelegantly get the song length,
-       this should probably be part of hvl_replay instead
-    */
-	while(!rndr_data->hvl->ht_SongEndReached) {
-        hvl_DecodeFrame(rndr_data->hvl, (int8*) b1[nb], (int8*) b2[nb]+2, 2);
-        frames_total += HIVELY_LEN;
-        nb = (nb+1)%8;
-    }
-	rndr_data->track_length = frames_total;
+	// the sequencer alone works out the length, and leaves the tune at its
+	// start, if it fails the length is found while playing instead
+	frames_total = hvl_ScanLength(rndr_data->hvl,
+	                              HVL_MAX_SCAN_SEC * rndr_data->fs);
+
+	if (frames_total > 0)
+		rndr_data->track_length = frames_total;
+
 	return 0;
 }
 
 static bool
 HVLRenderer_CanLoad(const AudioRenderer* obj,
                     const void* data,
-                    const size_t len)
+                    const size_t len,
+                    void** prepared)
 {
 	(void) obj;
+	(void) prepared;
 
 	if (len > 2 && (!memcmp(data, "THX", 3) || !memcmp(data, "HVL", 3)))
 		return true;
@@ -97,6 +112,23 @@ HVLRenderer_CanLoad(const AudioRenderer* obj,
 	return false;
 }
 
+static const AudioRenderer_Sig HVLRenderer_SigTable[] = {
+	{ "THX", 0, 3, NULL, ARC_CERTAIN },
+	{ "HVL", 0, 3, NULL, ARC_CERTAIN },
+	{ NULL, 0, 0, "ahx", ARC_EXT },
+	{ NULL, 0, 0, "thx", ARC_EXT },
+	{ NULL, 0, 0, "hvl", ARC_EXT },
+	{ NULL, 0, 0, NULL, ARC_NONE }
+};
+
+static const AudioRenderer_Sig*
+HVLRenderer_Sigs(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return HVLRenderer_SigTable;
+}
+
 static bool
 HVLRenderer_Loaded(const AudioRenderer* obj)
 {
@@ -121,50 +153,68 @@ HVLRenderer_UnLoad(const AudioRenderer* obj)
 	rndr_data->title[0] = '\0';
 	rndr_data->total_frames_rendered = 0;
 	rndr_data->hivelyIndex = 0;
+	rndr_data->hivelyLen = 0;
 	rndr_data->track_length = -1;
 
 }
 
-static int
-HVLRenderer_Render(const AudioRenderer* obj,
-                   void* buf,
-                   const size_t len)
+// Whole frames are decoded straight into buf, only a frame split by the
+// end of buf goes through the frame buffer.
+static void
+HVLRenderer_RenderS16(void* user, int16_t* buf, size_t frames)
 {
-	DataObject(rndr_data, obj);
-    int16 *out;
-    int i;
-	size_t length;
-	size_t streamPos = 0;
-	length = len >> 1;
-	out = (int16*) buf;
+	HVLRenderer_Data* rndr_data = (HVLRenderer_Data*) user;
+	size_t pos = 0;
 
 	if (rndr_data->hvl) {
 		// Flush remains of previous frame
-		for (i = rndr_data->hivelyIndex; i < (HIVELY_LEN); i++) {
-			out[streamPos++] = rndr_data->hivelyLeft[i];
-			out[streamPos++] = rndr_data->hivelyRight[i];
-		}
-
-		while (streamPos < length) {
-			hvl_DecodeFrame(rndr_data->hvl,
-			                (int8*) rndr_data->hivelyLeft,
-			                (int8*) rndr_data->hivelyRight,
-			                2);
+		pos = min_size(rndr_data->hivelyLen - rndr_data->hivelyIndex, frames);
+		memcpy(buf, rndr_data->hively + rndr_data->hivelyIndex * 2,
+		       pos * 2 * sizeof(int16));
+		rndr_data->hivelyIndex += pos;
+
+		while (pos < frames) {
+			size_t frame_len = HVLRenderer_FrameLen(rndr_data->hvl);
+			size_t n = min_size(frame_len, frames - pos);
+
+			if (n == frame_len) {
+				hvl_DecodeFrame(rndr_data->hvl,
+				                (int8*) (buf + pos * 2),
+				                (int8*) (buf + pos * 2 + 1),
+				                4);
+			} else {
+				hvl_DecodeFrame(rndr_data->hvl,
+				                (int8*) rndr_data->hively,
+				                (int8*) (rndr_data->hively + 1),
+				                4);
+				memcpy(buf + pos * 2, rndr_data->hively, n * 2 * sizeof(int16));
+				rndr_data->hivelyLen = frame_len;
+				rndr_data->hivelyIndex = n;
+			}
 
 			if (rndr_data->hvl->ht_SongEndReached && rndr_data->track_length == -1)
 				rndr_data->track_length = rndr_data->total_frames_rendered;
 
-			for (i = 0; i < (HIVELY_LEN) && streamPos < length; i++) {
-				out[streamPos++] = rndr_data->hivelyLeft[i];
-				out[streamPos++] = rndr_data->hivelyRight[i];
-			}
+			pos += n;
 		}
-		rndr_data->hivelyIndex = i;
 	}
 
-	rndr_data->total_frames_rendered += streamPos / 2; // not sure this is correct
+	rndr_data->total_frames_rendered += pos;
+}
 
-	return streamPos;
+static int
+HVLRenderer_Render(const AudioRenderer* obj,
+                   void* buf,
+                   const size_t len)
+{
+	DataObject(rndr_data, obj);
+	size_t frames = len / Sample_FrameBytes(rndr_data->bits,
+	                                        rndr_data->channels);
+
+	Sample_RenderS16(HVLRenderer_RenderS16, rndr_data, 2,
+	                 buf, rndr_data->bits, rndr_data->channels, frames);
+
+	return frames * rndr_data->channels;
 }
 
 static const char*
@@ -212,6 +262,69 @@ HVLRenderer_Length(const AudioRenderer* obj)
 	return 0;
 }
 
+// the song length covers the end, the song itself loops
+static bool
+HVLRenderer_Ended(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return false;
+}
+
+// The sequencer runs alone up to the frame the position falls in, a seek
+// back starts the subsong over first.
+static int
+HVLRenderer_Seek(const AudioRenderer* obj, int ms)
+{
+	size_t target, pos;
+
+	DataObject(rndr_data, obj);
+
+	if (rndr_data->hvl == NULL)
+		return -1;
+
+	target = (size_t) ms * rndr_data->fs / 1000;
+
+	if (rndr_data->track_length >= 0)
+		target = min_size(target, rndr_data->track_length);
+
+	if (target < rndr_data->total_frames_rendered) {
+		hvl_InitSubsong(rndr_data->hvl, rndr_data->hvl->ht_SongNum);
+		rndr_data->total_frames_rendered = 0;
+		rndr_data->hivelyIndex = rndr_data->hivelyLen = 0;
+	}
+
+	// the sequencer is already past what is left of the current frame
+	pos = rndr_data->total_frames_rendered
+	      + rndr_data->hivelyLen - rndr_data->hivelyIndex;
+	rndr_data->hivelyIndex = rndr_data->hivelyLen;
+
+	if (target > pos)
+		pos += hvl_Skip(rndr_data->hvl, min_size(target - pos, UINT32_MAX));
+
+	rndr_data->total_frames_rendered = pos;
+
+	return (int) (pos * 1000 / rndr_data->fs);
+}
+
+static bool
+HVLRenderer_CanSeekFast(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return true;
+}
+
+// the replayer has nothing to trade
+static int
+HVLRenderer_SetQuality(const AudioRenderer* obj, int level)
+{
+	(void) obj;
+	(void) level;
+
+	return 0;
+}
+
 static void
 HVLRenderer_Destroy(AudioRenderer* obj)
 {
@@ -219,6 +332,7 @@ HVLRenderer_Destroy(AudioRenderer* obj)
 
 	HVLRenderer_UnLoad((const AudioRenderer*) obj);
 
+	free(rndr_data->hively);
 	free(rndr_data);
 	free(obj);
 }
@@ -269,6 +383,7 @@ HVLRenderer_Create(int fs, int bits, int channels)
 
 		_vtable.Load     = (*HVLRenderer_Load);
 		_vtable.CanLoad  = (*HVLRenderer_CanLoad);
+		_vtable.Sigs     = (*HVLRenderer_Sigs);
 		_vtable.Loaded   = (*HVLRenderer_Loaded);
 		_vtable.UnLoad   = (*HVLRenderer_UnLoad);
 		_vtable.Render   = (*HVLRenderer_Render);
@@ -279,6 +394,10 @@ HVLRenderer_Create(int fs, int bits, int channels)
 		_vtable.SetTrack = (*HVLRenderer_SetTrack);
 		_vtable.PlayTime = (*HVLRenderer_PlayTime);
 		_vtable.Length   = (*HVLRenderer_Length);
+		_vtable.Ended    = (*HVLRenderer_Ended);
+		_vtable.Seek     = (*HVLRenderer_Seek);
+		_vtable.CanSeekFast = (*HVLRenderer_CanSeekFast);
+		_vtable.SetQuality = (*HVLRenderer_SetQuality);
 		_vtable.Destroy  = (*HVLRenderer_Destroy);
 
 		_initialized = true;
@@ -294,6 +413,9 @@ HVLRenderer_Create(int fs, int bits, int channels)
 	rndr_data->bits = bits;
 	rndr_data->channels = channels;
 
+	rndr_data->hively = (int16*) calloc(fs / HVL_FRAME_HZ * 2, sizeof(int16));
+	assert(rndr_data->hively);
+
 	rndr_data->current_track = -1;
 	rndr_data->track_length = -1;
 
@@ -4,15 +4,59 @@
 #include <assert.h>
 #include <malloc.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #include <inttypes.h>
 
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_timer.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
 #include <tinydir.h>
 
 #include "Directory.h"
+#include "DirScan.h"
+
+// the scan thread hands over what it has read after this many entries, or
+// this long after the last hand over, whichever comes first
+#define LOCALDIR_BATCH    (256)
+#define LOCALDIR_BATCH_MS (50)
+
+// directories left are kept, up to this many, until they change
+#define LOCALDIR_CACHE    (16)
 
 typedef struct LocalDir_Entry LocalDir_Entry;
+typedef struct LocalDir_Batch LocalDir_Batch;
+
+// A listed file or directory. The names of an entry are kept one after the
+// other in one buffer, so a listing is this record and the name per file.
+typedef struct LocalDir_File {
+	uint32_t name;
+	uint32_t is_dir;
+} LocalDir_File;
+
+typedef struct LocalDir_BatchFile {
+	const char* name;
+	bool is_dir;
+} LocalDir_BatchFile;
+
+struct LocalDir_Batch {
+	LocalDir_Batch* next;
+	size_t n,
+	       names_len;
+	LocalDir_BatchFile files[LOCALDIR_BATCH];
+	char names[LOCALDIR_BATCH * _TINYDIR_FILENAME_MAX];
+};
 
 struct LocalDir_Entry {
 	LocalDir_Entry* next, *prev;
@@ -20,14 +64,41 @@ struct LocalDir_Entry {
 	char path[_TINYDIR_PATH_MAX];
 	size_t subdir_idx;
 
-	tinydir_file* files;
+	LocalDir_File* files;
+	size_t files_cap;
+
+	char* names;
+	size_t names_len,
+	       names_cap;
 
 	size_t n_dirs,
 	       n_files;
+
+	// The directory is read by a thread of its own, which hands over
+	// sorted batches. They are merged into files by whoever calls Update
+	// while this is the head.
+	DirScan* scan;
+	SDL_Thread* scan_thread;
+	SDL_mutex* mutex;
+	LocalDir_Batch* pending;
+	bool scanning;
+	atomic_bool cancel;
+
+	// the inotify watch on path, and whether it has reported a change
+	// since the entry was made
+	int wd;
+	bool changed;
 };
 
 typedef struct LocalDir_Data {
 	LocalDir_Entry* root, *head;
+
+	// Listings of directories that have been left, most recently left
+	// first. Only complete listings of watched directories are kept, and
+	// they are dropped as soon as their directory changes.
+	LocalDir_Entry* cache[LOCALDIR_CACHE];
+	size_t n_cached;
+	int inotify_fd;
 } LocalDir_Data;
 
 #define DataObjects(a, b, c) \
@@ -48,6 +119,51 @@ typedef struct LocalDir_Data {
 static LocalDir_Entry*
 LocalDir_MakeEntry(const char* path);
 
+static void
+LocalDir_FreeEntry(LocalDir_Entry* e);
+
+static LocalDir_Entry*
+LocalDir_Open(LocalDir_Data* dir_data, const char* path);
+
+static void
+LocalDir_Leave(LocalDir_Data* dir_data, LocalDir_Entry* e);
+
+static void
+LocalDir_Drop(LocalDir_Data* dir_data, LocalDir_Entry* e);
+
+static void
+LocalDir_PollWatches(LocalDir_Data* dir_data);
+
+static inline const char*
+LocalDir_Name(const LocalDir_Entry* e,
+              size_t idx)
+{
+	return e->names + e->files[idx].name;
+}
+
+// Grows a buffer of cap elements to hold at least need, doubling it.
+static void*
+LocalDir_Grow(void* p,
+              size_t* cap,
+              size_t need,
+              size_t size)
+{
+	size_t c = *cap > 0 ? *cap : 64;
+
+	if (need <= *cap)
+		return p;
+
+	while (c < need)
+		c *= 2;
+
+	p = realloc(p, c * size);
+	assert(p);
+
+	*cap = c;
+
+	return p;
+}
+
 static int
 LocalDir_StrCpy(char dest[_TINYDIR_PATH_MAX],
                 const char src[_TINYDIR_PATH_MAX])
@@ -88,12 +204,37 @@ LocalDir_LoadDir(const Directory* obj,
 	if (idx >= e->n_dirs + e->n_files || !e->files[idx].is_dir)
 		return -1;
 
+	LocalDir_PollWatches(dir_data);
+
 	np_len = LocalDir_StrCpy(new_path, e->path);
 
-	if (strncmp(e->files[idx].name, "..", _TINYDIR_PATH_MAX - 1) == 0) {
+	if (strncmp(LocalDir_Name(e, idx), "..", _TINYDIR_PATH_MAX - 1) == 0) {
 		if (e->prev != NULL) {
 			// we have entered this directory previously
-			dir_data->head = e->prev;
+			new_e = e->prev;
+
+			// but it has changed since, so it is read again
+			if (new_e->changed) {
+				LocalDir_Entry* old_e = new_e;
+
+				if ((new_e = LocalDir_Open(dir_data, old_e->path)) != NULL) {
+					new_e->prev = old_e->prev;
+
+					if (new_e->prev != NULL)
+						new_e->prev->next = new_e;
+
+					if (dir_data->root == old_e)
+						dir_data->root = new_e;
+
+					// the new entry may share the watch
+					e->prev = new_e;
+					LocalDir_Drop(dir_data, old_e);
+				} else {
+					new_e = old_e;
+				}
+			}
+
+			dir_data->head = new_e;
 			dir_data->head->next = NULL;
 		} else {
 			// we need to make a new root entry of the cwd parent
@@ -106,15 +247,14 @@ LocalDir_LoadDir(const Directory* obj,
 				new_path[sep_idx] = DIRSEP;
 				new_path[sep_idx + 1] = '\0';
 			}
-			new_e = LocalDir_MakeEntry((const char*) new_path);
+			new_e = LocalDir_Open(dir_data, (const char*) new_path);
 			assert(new_e);
 			dir_data->root = dir_data->head = new_e;
 		}
-		free(e->files);
-		free(e);
+		LocalDir_Leave(dir_data, e);
 	} else {
-		LocalDir_Append(new_path, np_len, e->files[idx].name);
-		new_e = LocalDir_MakeEntry((const char*) new_path);
+		LocalDir_Append(new_path, np_len, LocalDir_Name(e, idx));
+		new_e = LocalDir_Open(dir_data, (const char*) new_path);
 		assert(new_e);
 		dir_data->head->subdir_idx = idx;
 		new_e->prev = dir_data->head;
@@ -170,7 +310,7 @@ LocalDir_GetName(const Directory* obj,
 	if (isdir != NULL)
 		*isdir = e->files[idx].is_dir;
 
-	return (const char*) e->files[idx].name;
+	return LocalDir_Name(e, idx);
 }
 
 static void
@@ -182,7 +322,7 @@ LocalDir_FullPath(const Directory* obj,
 
 	int p_len = LocalDir_StrCpy(path, e->path);
 
-	LocalDir_Append(path, p_len, e->files[idx].name);
+	LocalDir_Append(path, p_len, LocalDir_Name(e, idx));
 
 	// TODO: make sure this is a file, otherwise blank path or return NULL or something
 }
@@ -218,6 +358,67 @@ LocalDir_ReadFile(const char* path,
 	return (void*) data;
 }
 
+// Maps a file read only, where there is mmap, and reads it where there is
+// not. Either way the file is released with LocalDir_UnmapFile.
+void*
+LocalDir_MapFile(const char* path,
+                 size_t* len,
+                 size_t max_len)
+{
+#ifdef _WIN32
+	return LocalDir_ReadFile(path, len, max_len);
+#else
+	struct stat st;
+	void* data;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+	                        || st.st_size <= 0
+	                        || (size_t) st.st_size >= max_len) {
+		close(fd);
+		return NULL;
+	}
+
+	// the whole file is parsed right away, so it is read in up front
+#ifdef MAP_POPULATE
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+	            fd, 0);
+#else
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (data != MAP_FAILED)
+		madvise(data, st.st_size, MADV_WILLNEED);
+#endif
+
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	*len = st.st_size;
+
+	return data;
+#endif
+}
+
+void
+LocalDir_UnmapFile(void* data,
+                   size_t len)
+{
+	if (data == NULL)
+		return;
+
+#ifdef _WIN32
+	(void) len;
+	free(data);
+#else
+	munmap(data, len);
+#endif
+}
+
 static void*
 LocalDir_GetFile(const Directory* obj,
                  size_t idx,
@@ -233,7 +434,7 @@ LocalDir_GetFile(const Directory* obj,
 		return NULL;
 
 	LocalDir_FullPath(obj, f_abspath, idx);
-	data = LocalDir_ReadFile(f_abspath, len, max_len);
+	data = LocalDir_MapFile(f_abspath, len, max_len);
 
 	return data;
 }
@@ -249,7 +450,7 @@ LocalDir_Print(const Directory* obj)
 	for (size_t i = 0; i < e->n_dirs + e->n_files; i++) {
 		fprintf(stdout, "[%" PRIu64 "] %s%s\n", i,
 		        e->files[i].is_dir ? DIRSEP_STR : " ",
-		        e->files[i].name);
+		        LocalDir_Name(e, i));
 	}
 }
 
@@ -261,7 +462,7 @@ LocalDir_PrintRecursive(const LocalDir_Entry* e, size_t depth)
 			fprintf(stdout, "  ");
 
 		fprintf(stdout, "%s%s\n", e->files[i].is_dir ? DIRSEP_STR : " ",
-		        e->files[i].name);
+		        LocalDir_Name(e, i));
 
 		if (e->subdir_idx > 0 && e->subdir_idx == i && e->next != NULL)
 			LocalDir_PrintRecursive(e->next, depth + 1);
@@ -283,92 +484,469 @@ LocalDir_Destroy(Directory* obj)
 
 	while (e != NULL) {
 		LocalDir_Entry* temp = e->prev;
-		free(e->files);
-		free(e);
+		LocalDir_FreeEntry(e);
 		e = temp;
 	}
 
+	for (size_t i = 0; i < dir_data->n_cached; i++)
+		LocalDir_FreeEntry(dir_data->cache[i]);
+
+#ifdef HAVE_SYS_INOTIFY_H
+	// takes the watches with it
+	if (dir_data->inotify_fd >= 0)
+		close(dir_data->inotify_fd);
+#endif
+
 	free(dir_data);
 	free(obj);
 }
 
 static int
-LocalDir_FileCmp(const void* a, const void* b)
+LocalDir_NameCmp(const char* a,
+                 bool a_dir,
+                 const char* b,
+                 bool b_dir)
 {
-	const tinydir_file* fa = (const tinydir_file*) a;
-	const tinydir_file* fb = (const tinydir_file*) b;
-
-	if (fa->is_dir && !strncmp(fa->name, "..", 2))
+	if (a_dir && !strncmp(a, "..", 2))
 		return -1;
-	else if (fb->is_dir && !strncmp(fb->name, "..", 2))
+	else if (b_dir && !strncmp(b, "..", 2))
 		return 1;
 
-	if (fa->is_dir != fb->is_dir)
-		return -(fa->is_dir - fb->is_dir);
+	if (a_dir != b_dir)
+		return -(a_dir - b_dir);
+
+	return strncasecmp(a, b, _TINYDIR_FILENAME_MAX);
+}
+
+static int
+LocalDir_FileCmp(const void* a, const void* b)
+{
+	const LocalDir_BatchFile* fa = (const LocalDir_BatchFile*) a;
+	const LocalDir_BatchFile* fb = (const LocalDir_BatchFile*) b;
+
+	return LocalDir_NameCmp(fa->name, fa->is_dir, fb->name, fb->is_dir);
+}
+
+// Copies names to the end of the names of e and returns where they start.
+static uint32_t
+LocalDir_AddNames(LocalDir_Entry* e,
+                  const char* names,
+                  size_t len)
+{
+	uint32_t ofs = (uint32_t) e->names_len;
+
+	assert(e->names_len + len <= UINT32_MAX);
+
+	e->names = (char*) LocalDir_Grow(e->names, &e->names_cap,
+	                                 e->names_len + len, 1);
+	memcpy(e->names + e->names_len, names, len);
+	e->names_len += len;
 
-	return strncasecmp(fa->name, fb->name, _TINYDIR_FILENAME_MAX);
+	return ofs;
 }
 
+// Moves the entry at old index from to new index to, and the offsets
+// that pointed at it along with it.
+static void
+LocalDir_Move(LocalDir_Entry* e,
+              size_t from,
+              size_t to,
+              int* ofs,
+              size_t n_ofs)
+{
+	e->files[to] = e->files[from];
+
+	if (e->subdir_idx == from)
+		e->subdir_idx = to;
+
+	for (size_t i = 0; i < n_ofs; i++)
+		if (ofs[i] >= 0 && (size_t) ofs[i] == from)
+			ofs[i] = (int) to;
+}
+
+// Merges a sorted batch into the sorted files, from the back, so every
+// entry moves at most once.
+static void
+LocalDir_Merge(LocalDir_Entry* e,
+               const LocalDir_Batch* b,
+               int* ofs,
+               size_t n_ofs)
+{
+	size_t i = e->n_dirs + e->n_files,
+	       j = b->n,
+	       k = i + j;
+	uint32_t names = LocalDir_AddNames(e, b->names, b->names_len);
+
+	e->files = (LocalDir_File*) LocalDir_Grow(e->files, &e->files_cap,
+	                                          k, sizeof(LocalDir_File));
+
+	while (j > 0) {
+		const LocalDir_BatchFile* f = &b->files[j - 1];
+
+		k--;
+
+		if (i > 0 && LocalDir_NameCmp(LocalDir_Name(e, i - 1),
+		                              e->files[i - 1].is_dir,
+		                              f->name, f->is_dir) > 0) {
+			LocalDir_Move(e, --i, k, ofs, n_ofs);
+		} else {
+			e->files[k].name = names + (uint32_t) (f->name - b->names);
+			e->files[k].is_dir = f->is_dir;
+			j--;
+
+			if (f->is_dir)
+				e->n_dirs++;
+			else
+				e->n_files++;
+		}
+	}
+}
+
+static void
+LocalDir_Publish(LocalDir_Entry* e,
+                 LocalDir_Batch* b)
+{
+	LocalDir_Batch** tail;
+
+	qsort(b->files, b->n, sizeof(LocalDir_BatchFile), LocalDir_FileCmp);
+
+	SDL_LockMutex(e->mutex);
+
+	for (tail = &e->pending; *tail != NULL; tail = &(*tail)->next)
+		;
+
+	*tail = b;
+
+	SDL_UnlockMutex(e->mutex);
+}
+
+static int
+LocalDir_ScanThread(void* data)
+{
+	LocalDir_Entry* e = (LocalDir_Entry*) data;
+	LocalDir_Batch* b = NULL;
+	Uint32 t_batch = SDL_GetTicks();
+
+	const char* name;
+	DirScan_Type type;
+
+	// .. is there from the start, and DirScan leaves it out
+	while (!atomic_load(&e->cancel)
+	        && (name = DirScan_Next(e->scan, &type)) != NULL) {
+		LocalDir_BatchFile* bf;
+		size_t len = strnlen(name, _TINYDIR_FILENAME_MAX) + 1;
+
+		if (type == DS_OTHER || len > _TINYDIR_FILENAME_MAX)
+			continue;
+
+		if (b == NULL) {
+			b = (LocalDir_Batch*) malloc(sizeof(LocalDir_Batch));
+			assert(b);
+			b->next = NULL;
+			b->n = b->names_len = 0;
+		}
+
+		bf = &b->files[b->n++];
+		bf->name = b->names + b->names_len;
+		bf->is_dir = type == DS_DIR;
+		memcpy(b->names + b->names_len, name, len);
+		b->names_len += len;
+
+		if (b->n == LOCALDIR_BATCH
+		        || SDL_GetTicks() - t_batch >= LOCALDIR_BATCH_MS) {
+			LocalDir_Publish(e, b);
+			b = NULL;
+			t_batch = SDL_GetTicks();
+		}
+	}
+
+	if (b != NULL)
+		LocalDir_Publish(e, b);
+
+	DirScan_Close(e->scan);
+	e->scan = NULL;
+
+	SDL_LockMutex(e->mutex);
+	e->scanning = false;
+	SDL_UnlockMutex(e->mutex);
+
+	return 0;
+}
+
+static bool
+LocalDir_Update(const Directory* obj,
+                int* ofs,
+                size_t n_ofs)
+{
+	DataObjects(dir_data, e, obj);
+
+	LocalDir_Batch* b;
+	bool scanning;
+
+	LocalDir_PollWatches(dir_data);
+
+	SDL_LockMutex(e->mutex);
+	b = e->pending;
+	e->pending = NULL;
+	scanning = e->scanning;
+	SDL_UnlockMutex(e->mutex);
+
+	while (b != NULL) {
+		LocalDir_Batch* temp = b->next;
+		LocalDir_Merge(e, b, ofs, n_ofs);
+		free(b);
+		b = temp;
+	}
+
+	return scanning;
+}
+
+// Opens the directory and leaves reading it to a scan thread. The entry
+// starts out with only .., so there is a way back out before the scan has
+// got anywhere, see LocalDir_Update for the rest.
 static LocalDir_Entry*
 LocalDir_MakeEntry(const char* path)
 {
 	LocalDir_Entry* e;
-	tinydir_dir dir;
+	size_t len = strnlen(path, _TINYDIR_PATH_MAX);
 
 	e = (LocalDir_Entry*) calloc(1, sizeof(LocalDir_Entry));
 	assert(e);
 
 	e->subdir_idx = 0;
 	e->next = e->prev = NULL;
-	e->files = (tinydir_file*) malloc(sizeof(tinydir_file));
-	assert(e->files);
+	e->wd = -1;
+
+	if ((e->scan = DirScan_Open(path)) == NULL) {
+		free(e);
+		return NULL;
+	}
+
+	LocalDir_StrCpy(e->path, path);
+
+	// a root has nothing above it
+	if (len > 0 && path[len - 1] != DIRSEP) {
+		e->files = (LocalDir_File*) LocalDir_Grow(NULL, &e->files_cap, 1,
+		                                          sizeof(LocalDir_File));
+		e->files[0].name = LocalDir_AddNames(e, "..", sizeof(".."));
+		e->files[0].is_dir = true;
+		e->n_dirs = 1;
+	}
+
+	e->mutex = SDL_CreateMutex();
+	assert(e->mutex);
+
+	e->scanning = true;
+	atomic_init(&e->cancel, false);
+
+	e->scan_thread = SDL_CreateThread(LocalDir_ScanThread, NULL, (void*) e);
+	assert(e->scan_thread);
+
+	return e;
+}
+
+// Stops the scan thread, if it is still going, and frees the entry.
+static void
+LocalDir_FreeEntry(LocalDir_Entry* e)
+{
+	int status;
+
+	atomic_store(&e->cancel, true);
+	SDL_WaitThread(e->scan_thread, &status);
+
+	while (e->pending != NULL) {
+		LocalDir_Batch* temp = e->pending->next;
+		free(e->pending);
+		e->pending = temp;
+	}
+
+	SDL_DestroyMutex(e->mutex);
+	free(e->files);
+	free(e->names);
+	free(e);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define LOCALDIR_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM \
+                             | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF \
+                             | IN_ONLYDIR)
+#endif
+
+// Whether anything but skip, in the current directories or the cache,
+// still uses watch wd. Directories reached by more than one path share it.
+static bool
+LocalDir_WatchUsed(const LocalDir_Data* dir_data,
+                   const LocalDir_Entry* skip,
+                   int wd)
+{
+	for (const LocalDir_Entry* e = dir_data->head; e != NULL; e = e->prev)
+		if (e != skip && e->wd == wd)
+			return true;
+
+	for (size_t i = 0; i < dir_data->n_cached; i++)
+		if (dir_data->cache[i] != skip && dir_data->cache[i]->wd == wd)
+			return true;
+
+	return false;
+}
+
+static void
+LocalDir_Unwatch(LocalDir_Data* dir_data,
+                 const LocalDir_Entry* e)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (e->wd >= 0 && !LocalDir_WatchUsed(dir_data, e, e->wd))
+		inotify_rm_watch(dir_data->inotify_fd, e->wd);
+#else
+	(void) dir_data;
+	(void) e;
+#endif
+}
+
+// Frees an entry that is no longer in the current directories or the cache.
+static void
+LocalDir_Drop(LocalDir_Data* dir_data,
+              LocalDir_Entry* e)
+{
+	LocalDir_Unwatch(dir_data, e);
+	LocalDir_FreeEntry(e);
+}
+
+// Marks the entries watch wd belongs to as changed, or all of them if wd
+// is negative.
+static void
+LocalDir_MarkChanged(LocalDir_Data* dir_data,
+                     int wd)
+{
+	for (LocalDir_Entry* e = dir_data->head; e != NULL; e = e->prev)
+		if (wd < 0 || e->wd == wd)
+			e->changed = true;
+
+	for (size_t i = 0; i < dir_data->n_cached; i++)
+		if (wd < 0 || dir_data->cache[i]->wd == wd)
+			dir_data->cache[i]->changed = true;
+}
+
+// Takes in what the watches have reported and drops the cached listings
+// that are out of date.
+static void
+LocalDir_PollWatches(LocalDir_Data* dir_data)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	char buf[4096]
+	    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	LocalDir_Entry* changed[LOCALDIR_CACHE];
+	size_t n = 0, n_changed = 0;
+	ssize_t len;
+
+	if (dir_data->inotify_fd < 0)
+		return;
+
+	while ((len = read(dir_data->inotify_fd, buf, sizeof(buf))) > 0) {
+		for (char* p = buf; p < buf + len; ) {
+			const struct inotify_event* ev = (const struct inotify_event*) p;
+
+			LocalDir_MarkChanged(dir_data,
+			                     ev->mask & IN_Q_OVERFLOW ? -1 : ev->wd);
+
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+
+	// out of the cache before their watches are looked up
+	for (size_t i = 0; i < dir_data->n_cached; i++) {
+		LocalDir_Entry* c = dir_data->cache[i];
 
-	if (-1 == tinydir_open(&dir, path))
-		goto fail;
+		if (c->changed)
+			changed[n_changed++] = c;
+		else
+			dir_data->cache[n++] = c;
+	}
+
+	dir_data->n_cached = n;
 
-	while (dir.has_next) {
-		tinydir_file f;
+	for (size_t i = 0; i < n_changed; i++)
+		LocalDir_Drop(dir_data, changed[i]);
+#else
+	(void) dir_data;
+#endif
+}
 
-		if (-1 == tinydir_readfile(&dir, &f))
-			goto fail;
+// The listing of path, from the cache if it is there, read anew if not.
+static LocalDir_Entry*
+LocalDir_Open(LocalDir_Data* dir_data,
+              const char* path)
+{
+	LocalDir_Entry* e;
+	int wd = -1;
 
-		if (-1 == tinydir_next(&dir))
-			goto fail;
+	for (size_t i = 0; i < dir_data->n_cached; i++) {
+		e = dir_data->cache[i];
 
-		if (strncmp(f.name, ".", _TINYDIR_PATH_MAX - 1) == 0)
+		if (strncmp(e->path, path, _TINYDIR_PATH_MAX) != 0)
 			continue;
 
-		if (f.is_dir || f.is_reg)
-			e->files[e->n_files + e->n_dirs] = f;
+		memmove(&dir_data->cache[i],
+		        &dir_data->cache[i + 1],
+		        (dir_data->n_cached - i - 1) * sizeof(LocalDir_Entry*));
+		dir_data->n_cached--;
 
-		if (f.is_dir)
-			e->n_dirs++;
-		else if (f.is_reg)
-			e->n_files++;
+		e->next = e->prev = NULL;
 
-		e->files = (tinydir_file*) realloc(e->files,
-		                                   (1 + e->n_files + e->n_dirs) *
-		                                       sizeof(tinydir_file));
-		assert(e->files);
+		return e;
 	}
 
-	tinydir_close(&dir);
+#ifdef HAVE_SYS_INOTIFY_H
+	// watched from before the scan starts, so no change goes unseen
+	if (dir_data->inotify_fd >= 0)
+		wd = inotify_add_watch(dir_data->inotify_fd, path,
+		                       LOCALDIR_WATCH_MASK);
+#endif
 
-	LocalDir_StrCpy(e->path, path);
+	e = LocalDir_MakeEntry(path);
 
-	qsort(e->files,
-	      e->n_files + e->n_dirs,
-	      sizeof(tinydir_file),
-	      LocalDir_FileCmp);
+	if (e == NULL) {
+#ifdef HAVE_SYS_INOTIFY_H
+		if (wd >= 0 && !LocalDir_WatchUsed(dir_data, NULL, wd))
+			inotify_rm_watch(dir_data->inotify_fd, wd);
+#endif
+		return NULL;
+	}
+
+	e->wd = wd;
 
 	return e;
+}
 
-fail:
-	free(e->files);
-	free(e);
-	tinydir_close(&dir);
+// Keeps the listing of a directory that has been left in the cache, if it
+// is complete and can be told to be up to date.
+static void
+LocalDir_Leave(LocalDir_Data* dir_data,
+               LocalDir_Entry* e)
+{
+	bool scanning;
+
+	SDL_LockMutex(e->mutex);
+	scanning = e->scanning;
+	SDL_UnlockMutex(e->mutex);
+
+	if (e->wd < 0 || e->changed || scanning) {
+		LocalDir_Drop(dir_data, e);
+		return;
+	}
 
-	return NULL;
+	if (dir_data->n_cached == LOCALDIR_CACHE) {
+		LocalDir_Entry* lru = dir_data->cache[--dir_data->n_cached];
+		LocalDir_Drop(dir_data, lru);
+	}
+
+	memmove(&dir_data->cache[1],
+	        &dir_data->cache[0],
+	        dir_data->n_cached * sizeof(LocalDir_Entry*));
+	dir_data->cache[0] = e;
+	dir_data->n_cached++;
+
+	e->next = e->prev = NULL;
 }
 
 Directory*
@@ -386,6 +964,7 @@ LocalDir_Create(const char* path)
 		memset((void*) &_vtable, 0, sizeof(Directory_VTable));
 
 		_vtable.LoadDir   = (*LocalDir_LoadDir);
+		_vtable.Update    = (*LocalDir_Update);
 		_vtable.SubDirIdx = (*LocalDir_SubDirIdx);
 		_vtable.NDirs     = (*LocalDir_NDirs);
 		_vtable.NFiles    = (*LocalDir_NFiles);
@@ -393,6 +972,7 @@ LocalDir_Create(const char* path)
 		_vtable.GetName   = (*LocalDir_GetName);
 		_vtable.FullPath  = (*LocalDir_FullPath);
 		_vtable.GetFile   = (*LocalDir_GetFile);
+		_vtable.FreeFile  = (*LocalDir_UnmapFile);
 		_vtable.Print     = (*LocalDir_Print);
 		_vtable.PrintTree = (*LocalDir_PrintTree);
 		_vtable.Destroy   = (*LocalDir_Destroy);
@@ -406,10 +986,16 @@ LocalDir_Create(const char* path)
 	dir_data = (LocalDir_Data*) calloc(1, sizeof(LocalDir_Data));
 	assert(dir_data);
 
+#ifdef HAVE_SYS_INOTIFY_H
+	dir_data->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	dir_data->inotify_fd = -1;
+#endif
+
 	assert(strnlen(path, _TINYDIR_PATH_MAX) < _TINYDIR_PATH_MAX);
 	assert(realpath(path, (char* restrict) resolved_path));
 
-	dir_data->root = LocalDir_MakeEntry((const char*) resolved_path);
+	dir_data->root = LocalDir_Open(dir_data, (const char*) resolved_path);
 	assert(dir_data->root);
 
 	dir_data->head = dir_data->root;
@@ -8,5 +8,7 @@
 
 Directory* LocalDir_Create(const char*);
 void*      LocalDir_ReadFile(const char*, size_t*, size_t);
+void*      LocalDir_MapFile(const char*, size_t*, size_t);
+void       LocalDir_UnmapFile(void*, size_t);
 
 #endif /* SRC_LOCALDIR_H_ */
@@ -0,0 +1,14 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_MD5_H_
+#define SRC_MD5_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5_DIGEST_LEN (16)
+
+void MD5_Sum(const void*, size_t, uint8_t[MD5_DIGEST_LEN]);
+
+#endif /* SRC_MD5_H_ */
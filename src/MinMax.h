@@ -4,6 +4,8 @@
 #ifndef SRC_MINMAX_H_
 #define SRC_MINMAX_H_
 
+#include <stddef.h>
+
 static inline int
 min_int(int a, int b) { return (a < b) ? a : b; }
 static inline int
@@ -19,4 +21,9 @@ min_float(float a, float b) { return (a < b) ? a : b; }
 static inline float
 max_float(float a, float b) { return (a > b) ? a : b; }
 
+static inline size_t
+min_size(size_t a, size_t b) { return (a < b) ? a : b; }
+static inline size_t
+max_size(size_t a, size_t b) { return (a > b) ? a : b; }
+
 #endif /* SRC_MINMAX_H_ */
@@ -12,16 +12,25 @@
 #include <libopenmpt/libopenmpt.h>
 
 #include "OpenMPTRenderer.h"
+#include "Sample.h"
+#include "MinMax.h"
 #include "Globals.h"
 
 #define openmpt_probe    openmpt_probe_file_header
 #define openmpt_load     openmpt_module_create_from_memory2
-#define openmpt_read     openmpt_module_read_interleaved_stereo
+
+#define OPENMPT_QUALITIES (4)
+
+// interpolation filter taps by quality level, libopenmpt's default first
+static const int32_t OpenMPTRenderer_FilterLength[OPENMPT_QUALITIES] = {
+	8, 4, 2, 1
+};
 
 typedef struct OpenMPTRenderer_Data {
 	char title[MODP_STR_LENGTH];
 	char info[MODP_STR_LENGTH];
 	openmpt_module* mod;
+	int quality;
 	_Atomic size_t total_frames_rendered;
 	int fs, bits, channels;
 } OpenMPTRenderer_Data;
@@ -64,15 +73,27 @@ OpenMPTRenderer_LogFunc(const char* message, void* userdata)
 		fprintf(stderr, "OpenMPTRenderer: %s\n", message);
 }
 
+static void
+OpenMPTRenderer_ApplyQuality(OpenMPTRenderer_Data* rndr_data)
+{
+	openmpt_module_set_render_param(
+	        rndr_data->mod,
+	        OPENMPT_MODULE_RENDER_INTERPOLATIONFILTER_LENGTH,
+	        OpenMPTRenderer_FilterLength[rndr_data->quality]);
+}
+
 static int
 OpenMPTRenderer_Load(const AudioRenderer* obj,
                      const char* filename,
                      const void* data,
-                     const size_t len)
+                     const size_t len,
+                     void* prepared)
 {
 	const char* openmpt_str;
 	const char* source;
 
+	(void) prepared;
+
 	DataObject(rndr_data, obj);
 
 	openmpt_module_initial_ctl ctl[2] = {
@@ -89,6 +110,8 @@ OpenMPTRenderer_Load(const AudioRenderer* obj,
 	if (rndr_data->mod == NULL)
 		return 1;
 
+	OpenMPTRenderer_ApplyQuality(rndr_data);
+
 	openmpt_str = openmpt_module_get_metadata(rndr_data->mod, "title");
 
 	source = (openmpt_str != NULL && *openmpt_str) ? openmpt_str : filename;
@@ -120,10 +143,13 @@ OpenMPTRenderer_Load(const AudioRenderer* obj,
 static bool
 OpenMPTRenderer_CanLoad(const AudioRenderer* obj,
                         const void* data,
-                        const size_t len)
+                        const size_t len,
+                        void** prepared)
 {
 	int r = 1;
 
+	(void) prepared;
+
 	DataObject(rndr_data, obj);
 
 	size_t headerlen = openmpt_probe_file_header_get_recommended_size();
@@ -135,6 +161,23 @@ OpenMPTRenderer_CanLoad(const AudioRenderer* obj,
 	return r == OPENMPT_PROBE_FILE_HEADER_RESULT_SUCCESS;
 }
 
+// only formats the other renderers do not handle, modules are
+// claimed by XMPRenderer first
+static const AudioRenderer_Sig OpenMPTRenderer_SigTable[] = {
+	{ NULL, 0, 0, "mptm", ARC_EXT },
+	{ NULL, 0, 0, "umx", ARC_EXT },
+	{ NULL, 0, 0, "mo3", ARC_EXT },
+	{ NULL, 0, 0, NULL, ARC_NONE }
+};
+
+static const AudioRenderer_Sig*
+OpenMPTRenderer_Sigs(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return OpenMPTRenderer_SigTable;
+}
+
 static bool
 OpenMPTRenderer_Loaded(const AudioRenderer* obj)
 {
@@ -167,19 +210,33 @@ OpenMPTRenderer_Render(const AudioRenderer* obj,
 {
 	DataObject(rndr_data, obj);
 
-	int16_t* rndr_buf = (int16_t*) buf;
+	openmpt_module* mod = rndr_data->mod;
+	int fs = rndr_data->fs;
+	int ch = rndr_data->channels;
 
-	size_t byte_scale = (rndr_data->bits / 8) * rndr_data->channels;
+	size_t byte_scale = Sample_FrameBytes(rndr_data->bits, ch);
 	size_t rendered = 0; // frames
 	size_t to_render = len / byte_scale;
 
+	// libopenmpt renders every format natively, so nothing is converted
 	// TODO: if too many frames are rendered, these should be stored
 	// and retrieved at next call (can this happen?)
 	while (rendered < to_render) {
-		rendered += openmpt_read(rndr_data->mod,
-		                         rndr_data->fs,
-		                         to_render - rendered,
-		                         rndr_buf + rendered * rndr_data->channels);
+		size_t n = to_render - rendered;
+
+		if (rndr_data->bits == SAMPLE_F32) {
+			float* rndr_buf = (float*) buf + rendered * ch;
+
+			rendered += ch == 1
+			            ? openmpt_module_read_float_mono(mod, fs, n, rndr_buf)
+			            : openmpt_module_read_interleaved_float_stereo(mod, fs, n, rndr_buf);
+		} else {
+			int16_t* rndr_buf = (int16_t*) buf + rendered * ch;
+
+			rendered += ch == 1
+			            ? openmpt_module_read_mono(mod, fs, n, rndr_buf)
+			            : openmpt_module_read_interleaved_stereo(mod, fs, n, rndr_buf);
+		}
 	}
 
 	assert(((int) rendered - to_render) == 0);
@@ -230,6 +287,53 @@ OpenMPTRenderer_Length(const AudioRenderer* obj)
 		return 0;
 }
 
+// modules play on at their end, the duration is where they stop
+static bool
+OpenMPTRenderer_Ended(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return false;
+}
+
+static int
+OpenMPTRenderer_Seek(const AudioRenderer* obj, int ms)
+{
+	double pos;
+
+	DataObject(rndr_data, obj);
+
+	if (rndr_data->mod == NULL)
+		return -1;
+
+	pos = openmpt_module_set_position_seconds(rndr_data->mod, ms / 1000.);
+
+	rndr_data->total_frames_rendered = (size_t) (pos * rndr_data->fs);
+
+	return (int) (pos * 1000.);
+}
+
+static bool
+OpenMPTRenderer_CanSeekFast(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return true;
+}
+
+static int
+OpenMPTRenderer_SetQuality(const AudioRenderer* obj, int level)
+{
+	DataObject(rndr_data, obj);
+
+	rndr_data->quality = min_int(level, OPENMPT_QUALITIES - 1);
+
+	if (rndr_data->mod != NULL)
+		OpenMPTRenderer_ApplyQuality(rndr_data);
+
+	return rndr_data->quality;
+}
+
 static void
 OpenMPTRenderer_Destroy(AudioRenderer* obj)
 {
@@ -287,6 +391,7 @@ OpenMPTRenderer_Create(int fs, int bits, int channels)
 
 		_vtable.Load     = (*OpenMPTRenderer_Load);
 		_vtable.CanLoad  = (*OpenMPTRenderer_CanLoad);
+		_vtable.Sigs     = (*OpenMPTRenderer_Sigs);
 		_vtable.Loaded   = (*OpenMPTRenderer_Loaded);
 		_vtable.UnLoad   = (*OpenMPTRenderer_UnLoad);
 		_vtable.Render   = (*OpenMPTRenderer_Render);
@@ -297,6 +402,10 @@ OpenMPTRenderer_Create(int fs, int bits, int channels)
 		_vtable.SetTrack = (*OpenMPTRenderer_SetTrack);
 		_vtable.PlayTime = (*OpenMPTRenderer_PlayTime);
 		_vtable.Length   = (*OpenMPTRenderer_Length);
+		_vtable.Ended    = (*OpenMPTRenderer_Ended);
+		_vtable.Seek     = (*OpenMPTRenderer_Seek);
+		_vtable.CanSeekFast = (*OpenMPTRenderer_CanSeekFast);
+		_vtable.SetQuality = (*OpenMPTRenderer_SetQuality);
 		_vtable.Destroy  = (*OpenMPTRenderer_Destroy);
 
 		_initialized = true;
@@ -25,9 +25,15 @@ Player_Perform(Player_State* ps)
 
 	filename = Directory_GetName(ps->dir, ps->dir_ofs, &isdir);
 
+	// the directory is still being read
+	if (filename == NULL)
+		return -1;
+
 	if (isdir) {
 		Directory_LoadDir(ps->dir, ps->dir_ofs);
 		ps->dir_ofs = Directory_SubDirIdx(ps->dir);
+		ps->next_ofs = -1;
+		AudioManager_CancelPreload(ps->am);
 	} else {
 		char* data;
 		size_t len;
@@ -38,12 +44,14 @@ Player_Perform(Player_State* ps)
 		                         MODP_MAX_FILESIZE);
 
 		if (data != NULL) {
-			AudioRenderer* rend = AudioManager_CanLoad(ps->am, data, len);
+			void* prepared;
+			AudioRenderer* rend = AudioManager_CanLoad(ps->am, filename,
+			                                           data, len, &prepared);
 
 			if (rend)
-				AudioManager_Load(ps->am, rend, filename, data, len);
+				AudioManager_Load(ps->am, rend, prepared, filename, data, len);
 
-			free(data);
+			Directory_FreeFile(ps->dir, data, len);
 		}
 	}
 
@@ -60,10 +68,12 @@ Player_DirUp(Player_State* ps)
 
 	name = Directory_GetName(ps->dir, 0, &isdir);
 
-	if (isdir && strncmp(name, "..", _TINYDIR_PATH_MAX) == 0) {
+	if (name != NULL && isdir && strncmp(name, "..", _TINYDIR_PATH_MAX) == 0) {
 		Directory_LoadDir(ps->dir, 0);
 
 		ps->dir_ofs = Directory_SubDirIdx(ps->dir);
+		ps->next_ofs = -1;
+		AudioManager_CancelPreload(ps->am);
 	}
 
 	return ps->dir_ofs;
@@ -84,30 +94,40 @@ Player_End(Player_State* ps)
 {
 	assert(ps);
 
-	ps->dir_ofs = Directory_NTotal(ps->dir) - 1;
+	if (Directory_NTotal(ps->dir) > 0)
+		ps->dir_ofs = Directory_NTotal(ps->dir) - 1;
 
 	return ps->dir_ofs;
 }
 
-int
-Player_PlayNext(Player_State* ps, bool wrap)
+static int
+Player_NextOfs(Player_State* ps, bool wrap)
 {
 	int dir_total;
 	int dir_ndirs;
-
-	assert(ps);
+	int ofs;
 
 	dir_total = (int) Directory_NTotal(ps->dir);
 	dir_ndirs = (int) Directory_NDirs(ps->dir);
 
-	if (Directory_NFiles(ps->dir) > 0) {
-		ps->dir_ofs += 1;
+	ofs = ps->dir_ofs + 1;
 
-		if (ps->dir_ofs < dir_ndirs)
-			ps->dir_ofs = dir_ndirs;
+	if (ofs < dir_ndirs)
+		ofs = dir_ndirs;
 
-		if (ps->dir_ofs >= dir_total)
-			ps->dir_ofs = wrap ? dir_ndirs : dir_total - 1;
+	if (ofs >= dir_total)
+		ofs = wrap ? dir_ndirs : dir_total - 1;
+
+	return ofs;
+}
+
+int
+Player_PlayNext(Player_State* ps, bool wrap)
+{
+	assert(ps);
+
+	if (Directory_NFiles(ps->dir) > 0) {
+		ps->dir_ofs = Player_NextOfs(ps, wrap);
 
 		Player_Perform(ps);
 	}
@@ -170,12 +190,30 @@ Player_AlterOffset(Player_State* ps, int n)
 
 	ps->dir_ofs += n;
 
-	ps->dir_ofs = ps->dir_ofs < 0 ? 0 : ps->dir_ofs;
 	ps->dir_ofs = ps->dir_ofs > dir_total - 1 ? dir_total - 1 : ps->dir_ofs;
+	ps->dir_ofs = ps->dir_ofs < 0 ? 0 : ps->dir_ofs;
 
 	return ps->dir_ofs;
 }
 
+// Takes in what the directory scan has read since the last call, keeping
+// the selection and the preloaded entry on the entries they were on.
+void
+Player_UpdateDir(Player_State* ps)
+{
+	int ofs[2];
+
+	assert(ps);
+
+	ofs[0] = ps->dir_ofs;
+	ofs[1] = ps->next_ofs;
+
+	ps->dir_scanning = Directory_Update(ps->dir, ofs, 2);
+
+	ps->dir_ofs = ofs[0];
+	ps->next_ofs = ofs[1];
+}
+
 int
 Player_AlterMinLength(Player_State* ps, int step)
 {
@@ -203,24 +241,96 @@ Player_ToggleAutoRnd(Player_State* ps)
 	ps->auto_rnd = !ps->auto_rnd;
 }
 
+// Hands the entry auto increment would play next to the preload thread,
+// once the selection has settled, so the render thread can move on to it
+// without a gap.
+static void
+Player_UpdatePreload(Player_State* ps,
+                     Uint32 t_now)
+{
+	unsigned int base = atomic_load(&ps->am->active);
+	int next_ofs;
+	bool isdir;
+	char* data;
+	size_t len;
+
+	if (!ps->auto_inc || Directory_NFiles(ps->dir) == 0
+	        || !AudioManager_Loaded(ps->am)
+	        || t_now - ps->last_input < MODP_PRELOAD_MS)
+		return;
+
+	if (ps->auto_rnd)
+		next_ofs = ps->next_ofs >= 0 && base == ps->next_base
+		           ? ps->next_ofs
+		           : (int) Directory_NDirs(ps->dir)
+		             + rand() % (int) Directory_NFiles(ps->dir);
+	else
+		next_ofs = Player_NextOfs(ps, true);
+
+	if (next_ofs == ps->next_ofs && base == ps->next_base)
+		return;
+
+	ps->next_ofs = next_ofs;
+	ps->next_base = base;
+
+	data = Directory_GetFile(ps->dir, next_ofs, &len, MODP_MAX_FILESIZE);
+
+	if (data != NULL)
+		AudioManager_Preload(ps->am,
+		                     Directory_GetName(ps->dir, next_ofs, &isdir),
+		                     data,
+		                     len,
+		                     ps->dir->vtable->FreeFile);
+}
+
 void
 Player_UpdateAutoInc(Player_State* ps,
                      bool got_input)
 {
+	AudioManager_NowPlaying now;
 	Uint32 t_now;
+	bool armed;
 	assert(ps);
 
 	if (got_input) {
 		ps->last_input = SDL_GetTicks();
+		AudioManager_SetAutoAdvance(ps->am, false, false);
 		return;
 	}
 
 	t_now = SDL_GetTicks();
 
-	if ((AudioRenderer_PlayTime(ps->am->active_ar) >=
-	        AudioRenderer_Length(ps->am->active_ar) &&
-	        (t_now - ps->last_input) / 1e3 > ps->min_length && ps->am->playing) ||
-	        (ps->am->playing && AudioManager_SilenceDetected(ps->am))) {
+	armed = ps->auto_inc && (t_now - ps->last_input) / 1e3 > ps->min_length;
+	AudioManager_SetAutoAdvance(ps->am, armed, !ps->auto_rnd);
+
+	// the render thread moved on by itself
+	switch (AudioManager_Advanced(ps->am)) {
+		case RTM_ADV_NEXT:
+			// a switch made just before a change of directory played a
+			// file of the old one
+			if (ps->next_ofs >= 0)
+				ps->dir_ofs = ps->next_ofs;
+			ps->last_input = t_now;
+			break;
+		case RTM_ADV_TRACK:
+			ps->last_input = t_now;
+			break;
+		default:
+			break;
+	}
+
+	Player_UpdatePreload(ps, t_now);
+
+	// a subtrack change or a seek is still on its way to the render thread
+	if (AudioManager_TrackPending(ps->am))
+		return;
+
+	AudioManager_GetNowPlaying(ps->am, &now);
+
+	if ((now.play_time >= now.length &&
+	        (t_now - ps->last_input) / 1e3 > ps->min_length && ps->am->playing &&
+	        !AudioManager_GaplessReady(ps->am)) ||
+	        (ps->am->playing && AudioManager_SilenceDetected(ps->am, NULL))) {
 		if (ps->auto_inc) {
 			if (ps->auto_rnd) {
 				Player_PlayRandom(ps);
@@ -250,9 +360,17 @@ Player_AlterSubTrack(Player_State* ps, int val)
 	AudioManager_AlterSubTrack(ps->am, val);
 }
 
+void
+Player_Seek(Player_State* ps, int ms)
+{
+	assert(ps);
+
+	AudioManager_Seek(ps->am, ms);
+}
+
 int
 Player_GetPlaybackData(Player_State* ps,
-                       T* buf,
+                       float* buf,
                        int len,
                        bool partial)
 {
@@ -261,7 +379,7 @@ Player_GetPlaybackData(Player_State* ps,
 	if (rb_count >= len) {
 		RingBuffer_Read(ps->am->playback_buf, buf, len);
 	} else if (partial && rb_count > 0 && rb_count < len) {
-		memmove(buf, buf + rb_count, (len - rb_count) * sizeof(T));
+		memmove(buf, buf + rb_count, (len - rb_count) * sizeof(float));
 		RingBuffer_Read(ps->am->playback_buf, buf + len - rb_count, rb_count);
 	}
 
@@ -280,7 +398,8 @@ Player_Destroy(Player_State* ps)
 }
 
 Player_State*
-Player_Init(int fs, int bits, int channels,
+Player_Init(int fs, int bits, int channels, int render_fs,
+            Resampler_Quality quality, const char* output,
             int min_length, bool auto_inc, bool auto_rnd,
             const char* path)
 {
@@ -292,8 +411,16 @@ Player_Init(int fs, int bits, int channels,
 	ps->min_length = min_length;
 	ps->auto_inc = auto_inc;
 	ps->auto_rnd = auto_rnd;
+	ps->next_ofs = -1;
+
+	ps->am = AudioManager_Create(fs, bits, channels, render_fs, quality,
+	                             output);
+
+	if (ps->am == NULL) {
+		free(ps);
+		return NULL;
+	}
 
-	ps->am = AudioManager_Create(fs, bits, channels);
 	ps->dir = LocalDir_Create(path);
 
 	ps->last_input = SDL_GetTicks();
@@ -6,8 +6,6 @@
 
 #include <stdbool.h>
 
-#include <portaudio.h>
-
 #include "Directory.h"
 #include "RingBuffer.h"
 #include "AudioManager.h"
@@ -15,6 +13,8 @@
 typedef struct Player_State {
 	Directory* dir;
 	int dir_ofs;
+	// the directory is still being read
+	bool dir_scanning;
 
 	int min_length;
 	bool auto_inc,
@@ -22,6 +22,11 @@ typedef struct Player_State {
 
 	AudioManager* am;
 	Uint32 last_input;
+
+	// entry handed to the preload thread, and the active word of
+	// AudioManager it was predicted for
+	int next_ofs;
+	unsigned int next_base;
 } Player_State;
 
 int           Player_Perform         (Player_State*);
@@ -32,15 +37,18 @@ int           Player_PlayNext        (Player_State*, bool);
 int           Player_PlayPrev        (Player_State*, bool);
 int           Player_PlayRandom      (Player_State*);
 int           Player_AlterOffset     (Player_State*, int);
+void          Player_UpdateDir       (Player_State*);
 int           Player_AlterMinLength  (Player_State*, int);
 void          Player_ToggleAutoInc   (Player_State*);
 void          Player_ToggleAutoRnd   (Player_State*);
 void          Player_UpdateAutoInc   (Player_State*, bool);
 void          Player_PlayPause       (Player_State*);
 void          Player_AlterSubTrack   (Player_State*, int);
-int           Player_GetPlaybackData (Player_State*, T*, int, bool);
+void          Player_Seek            (Player_State*, int);
+int           Player_GetPlaybackData (Player_State*, float*, int, bool);
 void          Player_Destroy         (Player_State*);
-Player_State* Player_Init            (int, int, int,
+Player_State* Player_Init            (int, int, int, int,
+                                      Resampler_Quality, const char*,
                                       int, bool, bool, const char*);
 
 #endif /* SRC_PLAYER_H_ */
@@ -0,0 +1,188 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <portaudio.h>
+
+#include "PortAudioOutput.h"
+#include "Sample.h"
+#include "Globals.h"
+
+typedef struct PortAudioOutput_Data {
+	PaStream* stream;
+	AudioOutput_Callback cb;
+	void* user;
+	_Atomic unsigned int xruns;
+	int fs, bits, channels;
+} PortAudioOutput_Data;
+
+#define DataObject(a, b) \
+	PortAudioOutput_Data* (a) = (PortAudioOutput_Data*) (b)->data; \
+	assert((a)); \
+	DebugPrint((b));
+
+static int
+PortAudioOutput_Callback(const void* in, void* out,
+                         unsigned long frames,
+                         const PaStreamCallbackTimeInfo* time_info,
+                         PaStreamCallbackFlags status_flags,
+                         void* user)
+{
+	PortAudioOutput_Data* out_data = (PortAudioOutput_Data*) user;
+
+	(void) in;
+	(void) time_info;
+
+	if (status_flags & paOutputUnderflow)
+		atomic_fetch_add(&out_data->xruns, 1);
+
+	out_data->cb(out, frames, out_data->user);
+
+	return paContinue;
+}
+
+static int
+PortAudioOutput_Start(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	if (Pa_IsStreamActive(out_data->stream) == 1)
+		return 0;
+
+	return Pa_StartStream(out_data->stream) != paNoError;
+}
+
+static int
+PortAudioOutput_Stop(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	if (Pa_IsStreamStopped(out_data->stream) == 1)
+		return 0;
+
+	// abort rather than drain, pausing should be immediate
+	return Pa_AbortStream(out_data->stream) != paNoError;
+}
+
+static bool
+PortAudioOutput_Active(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	return Pa_IsStreamActive(out_data->stream) == 1;
+}
+
+static double
+PortAudioOutput_Latency(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	const PaStreamInfo* info = Pa_GetStreamInfo(out_data->stream);
+
+	if (info == NULL)
+		return 0;
+
+	return info->outputLatency;
+}
+
+static unsigned int
+PortAudioOutput_XRuns(const AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	return atomic_load(&out_data->xruns);
+}
+
+static const char*
+PortAudioOutput_Name(const AudioOutput* obj)
+{
+	assert(obj);
+
+	return "portaudio";
+}
+
+static void
+PortAudioOutput_Destroy(AudioOutput* obj)
+{
+	DataObject(out_data, obj);
+
+	PortAudioOutput_Stop(obj);
+
+	Pa_CloseStream(out_data->stream);
+	Pa_Terminate();
+
+	free(out_data);
+	free(obj);
+}
+
+AudioOutput*
+PortAudioOutput_Create(int fs, int bits, int channels,
+                       AudioOutput_Callback cb, void* user)
+{
+	AudioOutput* aout;
+	PortAudioOutput_Data* out_data;
+	PaError err;
+	static AudioOutput_VTable _vtable;
+	static bool _initialized = false;
+
+	if (!_initialized) {
+		memset((void*) &_vtable, 0, sizeof(AudioOutput_VTable));
+
+		_vtable.Start   = (*PortAudioOutput_Start);
+		_vtable.Stop    = (*PortAudioOutput_Stop);
+		_vtable.Active  = (*PortAudioOutput_Active);
+		_vtable.Latency = (*PortAudioOutput_Latency);
+		_vtable.XRuns   = (*PortAudioOutput_XRuns);
+		_vtable.Name    = (*PortAudioOutput_Name);
+		_vtable.Destroy = (*PortAudioOutput_Destroy);
+
+		_initialized = true;
+	}
+
+	out_data = (PortAudioOutput_Data*) calloc(1, sizeof(PortAudioOutput_Data));
+	assert(out_data);
+
+	out_data->cb = cb;
+	out_data->user = user;
+	out_data->fs = fs;
+	out_data->bits = bits;
+	out_data->channels = channels;
+	atomic_init(&out_data->xruns, 0);
+
+	err = Pa_Initialize();
+
+	if (err != paNoError) {
+		fprintf(stderr, "PortAudioOutput: %s\n", Pa_GetErrorText(err));
+		free(out_data);
+		return NULL;
+	}
+
+	err = Pa_OpenDefaultStream(&out_data->stream,
+	                           0,
+	                           channels,
+	                           bits == SAMPLE_F32 ? paFloat32 : paInt16,
+	                           fs,
+	                           MODP_OUT_FRAMES,
+	                           PortAudioOutput_Callback,
+	                           (void*) out_data);
+
+	if (err != paNoError) {
+		fprintf(stderr, "PortAudioOutput: %s\n", Pa_GetErrorText(err));
+		Pa_Terminate();
+		free(out_data);
+		return NULL;
+	}
+
+	aout = (AudioOutput*) calloc(1, sizeof(AudioOutput));
+	assert(aout);
+
+	aout->vtable = &_vtable;
+	aout->data = (void*) out_data;
+
+	return aout;
+}
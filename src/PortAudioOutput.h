@@ -0,0 +1,12 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef PORTAUDIOOUTPUT_H_
+#define PORTAUDIOOUTPUT_H_
+
+#include "AudioOutput.h"
+
+AudioOutput* PortAudioOutput_Create(int, int, int,
+                                    AudioOutput_Callback, void*);
+
+#endif /* PORTAUDIOOUTPUT_H_ */
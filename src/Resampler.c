@@ -0,0 +1,379 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RESAMPLER_AVX2
+#endif
+
+#include "Resampler.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// taps are a multiple of 8 for the AVX2 kernel, the phase rows are
+// interpolated linearly so the tables stay small
+static const struct {
+	const char* name;
+	int taps;
+	int phases;
+	double beta;
+	double rolloff;
+} Resampler_Presets[RSQ_COUNT] = {
+	{ "fast",  8,  64,  5.0, 0.80 },
+	{ "good", 24, 256,  8.0, 0.90 },
+	{ "best", 64, 512, 10.0, 0.95 }
+};
+
+static void
+Resampler_KernelScalar(const Resampler* rs,
+                       size_t ofs,
+                       const float* c0,
+                       const float* c1,
+                       float f,
+                       float* out)
+{
+	for (int c = 0; c < rs->channels; c++) {
+		const float* in = rs->buf[c] + ofs;
+		float acc = 0.f;
+
+		for (int k = 0; k < rs->taps; k++)
+			acc += in[k] * (c0[k] + f * (c1[k] - c0[k]));
+
+		out[c] = acc;
+	}
+}
+
+#if defined(__SSE2__)
+static float
+Resampler_Sum128(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+
+	return _mm_cvtss_f32(v);
+}
+
+static void
+Resampler_KernelSSE2(const Resampler* rs,
+                     size_t ofs,
+                     const float* c0,
+                     const float* c1,
+                     float f,
+                     float* out)
+{
+	const float* l = rs->buf[0] + ofs;
+	const float* r = rs->buf[rs->channels - 1] + ofs;
+	__m128 vf = _mm_set1_ps(f);
+	__m128 acc_l = _mm_setzero_ps();
+	__m128 acc_r = _mm_setzero_ps();
+
+	// the right channel is the left one again for mono, which is cheaper
+	// than a branch in the loop
+	for (int k = 0; k < rs->taps; k += 4) {
+		__m128 a = _mm_loadu_ps(c0 + k);
+		__m128 b = _mm_loadu_ps(c1 + k);
+		__m128 h = _mm_add_ps(a, _mm_mul_ps(vf, _mm_sub_ps(b, a)));
+
+		acc_l = _mm_add_ps(acc_l, _mm_mul_ps(_mm_loadu_ps(l + k), h));
+		acc_r = _mm_add_ps(acc_r, _mm_mul_ps(_mm_loadu_ps(r + k), h));
+	}
+
+	out[0] = Resampler_Sum128(acc_l);
+
+	if (rs->channels == 2)
+		out[1] = Resampler_Sum128(acc_r);
+}
+#endif
+
+#ifdef RESAMPLER_AVX2
+__attribute__((target("avx2,fma")))
+static float
+Resampler_Sum256(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v),
+	                      _mm256_extractf128_ps(v, 1));
+
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+	return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static void
+Resampler_KernelAVX2(const Resampler* rs,
+                     size_t ofs,
+                     const float* c0,
+                     const float* c1,
+                     float f,
+                     float* out)
+{
+	const float* l = rs->buf[0] + ofs;
+	const float* r = rs->buf[rs->channels - 1] + ofs;
+	__m256 vf = _mm256_set1_ps(f);
+	__m256 acc_l = _mm256_setzero_ps();
+	__m256 acc_r = _mm256_setzero_ps();
+
+	for (int k = 0; k < rs->taps; k += 8) {
+		__m256 a = _mm256_loadu_ps(c0 + k);
+		__m256 b = _mm256_loadu_ps(c1 + k);
+		__m256 h = _mm256_fmadd_ps(vf, _mm256_sub_ps(b, a), a);
+
+		acc_l = _mm256_fmadd_ps(_mm256_loadu_ps(l + k), h, acc_l);
+		acc_r = _mm256_fmadd_ps(_mm256_loadu_ps(r + k), h, acc_r);
+	}
+
+	out[0] = Resampler_Sum256(acc_l);
+
+	if (rs->channels == 2)
+		out[1] = Resampler_Sum256(acc_r);
+}
+#endif
+
+static void
+Resampler_SelectKernel(Resampler* rs)
+{
+	rs->kernel = Resampler_KernelScalar;
+	rs->isa = "scalar";
+
+#if defined(__SSE2__)
+	rs->kernel = Resampler_KernelSSE2;
+	rs->isa = "sse2";
+#endif
+
+#ifdef RESAMPLER_AVX2
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		rs->kernel = Resampler_KernelAVX2;
+		rs->isa = "avx2";
+	}
+#endif
+}
+
+// zeroth order modified Bessel function of the first kind, for the
+// Kaiser window
+static double
+Resampler_I0(double x)
+{
+	double sum = 1.0, term = 1.0;
+
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+
+		if (term < sum * 1e-12)
+			break;
+	}
+
+	return sum;
+}
+
+// Row p holds the taps for an output frame p / phases of an input frame
+// past the center tap, one extra row closes the interpolation. Each row
+// is normalized to unity gain.
+static void
+Resampler_MakeCoefs(Resampler* rs)
+{
+	double fc = Resampler_Presets[rs->quality].rolloff;
+	double beta = Resampler_Presets[rs->quality].beta;
+	double half = rs->taps / 2;
+
+	if (rs->out_fs < rs->in_fs)
+		fc *= (double) rs->out_fs / rs->in_fs;
+
+	for (int p = 0; p <= rs->phases; p++) {
+		float* row = rs->coefs + (size_t) p * rs->taps;
+		double sum = 0.0;
+
+		for (int k = 0; k < rs->taps; k++) {
+			double x = k - (half - 1) - (double) p / rs->phases;
+			double w = x / half;
+			double s = x == 0.0 ? 1.0 : sin(M_PI * fc * x) / (M_PI * fc * x);
+
+			w = w * w < 1.0 ? Resampler_I0(beta * sqrt(1.0 - w * w))
+			                  / Resampler_I0(beta) : 0.0;
+
+			row[k] = (float) (s * w);
+			sum += row[k];
+		}
+
+		for (int k = 0; k < rs->taps; k++)
+			row[k] = (float) (row[k] / sum);
+	}
+}
+
+void
+Resampler_Reset(Resampler* rs)
+{
+	assert(rs);
+
+	for (int c = 0; c < rs->channels; c++)
+		memset(rs->buf[c], 0, rs->cap * sizeof(float));
+
+	// the first output frame falls on the first input frame
+	rs->len = rs->taps / 2 - 1;
+	rs->pos = 0;
+	rs->frac = 0;
+}
+
+// Input frames to write before out_frames can be processed.
+size_t
+Resampler_InputNeeded(const Resampler* rs,
+                      size_t out_frames)
+{
+	size_t last;
+
+	if (out_frames == 0)
+		return 0;
+
+	last = rs->pos + (size_t) ((rs->frac + (uint64_t) (out_frames - 1)
+	                            * rs->in_fs) / rs->out_fs);
+
+	return last + rs->taps > rs->len ? last + rs->taps - rs->len : 0;
+}
+
+// The most input a Process call of max_out frames can need.
+size_t
+Resampler_MaxInput(const Resampler* rs)
+{
+	return rs->max_out * rs->in_fs / rs->out_fs + rs->taps + 2;
+}
+
+void
+Resampler_Write(Resampler* rs,
+                const float* in,
+                size_t frames)
+{
+	// drop the history no longer reached by the filter
+	if (rs->pos > 0) {
+		for (int c = 0; c < rs->channels; c++)
+			memmove(rs->buf[c], rs->buf[c] + rs->pos,
+			        (rs->len - rs->pos) * sizeof(float));
+
+		rs->len -= rs->pos;
+		rs->pos = 0;
+	}
+
+	assert(rs->len + frames <= rs->cap);
+
+	for (size_t i = 0; i < frames; i++)
+		for (int c = 0; c < rs->channels; c++)
+			rs->buf[c][rs->len + i] = in[i * rs->channels + c];
+
+	rs->len += frames;
+}
+
+void
+Resampler_Process(Resampler* rs,
+                  float* out,
+                  size_t frames)
+{
+	uint64_t step = (uint64_t) rs->in_fs / rs->out_fs;
+	uint64_t rem = (uint64_t) rs->in_fs % rs->out_fs;
+
+	assert(frames <= rs->max_out);
+	assert(Resampler_InputNeeded(rs, frames) == 0);
+
+	for (size_t i = 0; i < frames; i++) {
+		uint64_t x = rs->frac * rs->phases;
+		size_t p = (size_t) (x / rs->out_fs);
+		float f = (float) (x % rs->out_fs) / rs->out_fs;
+		const float* c0 = rs->coefs + p * rs->taps;
+
+		rs->kernel(rs, rs->pos, c0, c0 + rs->taps, f, out + i * rs->channels);
+
+		rs->frac += rem;
+		rs->pos += step;
+
+		if (rs->frac >= (uint64_t) rs->out_fs) {
+			rs->frac -= rs->out_fs;
+			rs->pos++;
+		}
+	}
+}
+
+const char*
+Resampler_QualityName(Resampler_Quality q)
+{
+	assert(q >= 0 && q < RSQ_COUNT);
+
+	return Resampler_Presets[q].name;
+}
+
+int
+Resampler_ParseQuality(const char* name)
+{
+	for (int q = 0; q < RSQ_COUNT; q++)
+		if (strcmp(name, Resampler_Presets[q].name) == 0)
+			return q;
+
+	return -1;
+}
+
+void
+Resampler_Destroy(Resampler* rs)
+{
+	assert(rs);
+
+	for (int c = 0; c < rs->channels; c++)
+		free(rs->buf[c]);
+
+	free(rs->coefs);
+	free(rs);
+}
+
+// max_out is the largest number of frames a Process call will ask for.
+Resampler*
+Resampler_Create(int in_fs,
+                 int out_fs,
+                 int channels,
+                 Resampler_Quality q,
+                 size_t max_out)
+{
+	Resampler* rs;
+
+	assert(in_fs > 0 && out_fs > 0);
+	assert(channels == 1 || channels == 2);
+	assert(q >= 0 && q < RSQ_COUNT);
+
+	rs = (Resampler*) calloc(1, sizeof(Resampler));
+	assert(rs);
+
+	rs->in_fs = in_fs;
+	rs->out_fs = out_fs;
+	rs->channels = channels;
+	rs->quality = q;
+	rs->taps = Resampler_Presets[q].taps;
+	rs->phases = Resampler_Presets[q].phases;
+	rs->max_out = max_out;
+
+	rs->coefs = (float*) calloc((size_t) (rs->phases + 1) * rs->taps,
+	                            sizeof(float));
+	assert(rs->coefs);
+
+	Resampler_MakeCoefs(rs);
+
+	rs->cap = Resampler_MaxInput(rs) + rs->taps;
+
+	for (int c = 0; c < channels; c++) {
+		rs->buf[c] = (float*) calloc(rs->cap, sizeof(float));
+		assert(rs->buf[c]);
+	}
+
+	Resampler_SelectKernel(rs);
+	Resampler_Reset(rs);
+
+	return rs;
+}
@@ -0,0 +1,60 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_RESAMPLER_H_
+#define SRC_RESAMPLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum Resampler_Quality {
+	RSQ_FAST,
+	RSQ_GOOD,
+	RSQ_BEST,
+	RSQ_COUNT
+} Resampler_Quality;
+
+typedef struct Resampler Resampler;
+
+// Kernel computing one output frame at input frame ofs, from the phase
+// rows c0 and c1 of the filter table, interpolated by f.
+typedef void (*Resampler_Kernel)(const Resampler*,
+                                 size_t,
+                                 const float*,
+                                 const float*,
+                                 float,
+                                 float*);
+
+// Polyphase windowed-sinc resampler on interleaved float frames. The
+// input is kept per channel, so the filter taps are contiguous for the
+// SIMD kernels. The read position advances by in_fs / out_fs exactly,
+// as an integer part and a remainder in units of 1 / out_fs.
+struct Resampler {
+	int in_fs, out_fs, channels;
+	Resampler_Quality quality;
+
+	int taps, phases;
+	float* coefs;
+
+	// input history per channel, pos is the first tap of the next
+	// output frame
+	float* buf[2];
+	size_t len, cap, max_out;
+	size_t pos;
+	uint64_t frac;
+
+	Resampler_Kernel kernel;
+	const char* isa;
+};
+
+Resampler*  Resampler_Create       (int, int, int, Resampler_Quality, size_t);
+void        Resampler_Destroy      (Resampler*);
+void        Resampler_Reset        (Resampler*);
+size_t      Resampler_InputNeeded  (const Resampler*, size_t);
+size_t      Resampler_MaxInput     (const Resampler*);
+void        Resampler_Write        (Resampler*, const float*, size_t);
+void        Resampler_Process      (Resampler*, float*, size_t);
+const char* Resampler_QualityName  (Resampler_Quality);
+int         Resampler_ParseQuality (const char*);
+
+#endif /* SRC_RESAMPLER_H_ */
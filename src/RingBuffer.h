@@ -13,39 +13,77 @@
 #include "Globals.h"
 #include "MinMax.h"
 
-typedef short T;
-
+// Single producer, single consumer. The capacity is a power of two and
+// the positions run freely, so indexing is a mask and the difference of
+// the positions is the fill count. Positions and counts are in elements
+// of the size given at creation. Each side owns one position and keeps
+// a snapshot of the other one, only reloading it when the snapshot says
+// there is not enough data or space. The two sides are kept on separate
+// cache lines.
 typedef struct RingBuffer {
-	T* buffer;
+	void* buffer;
+	unsigned int size,
+	             mask;
+	size_t elem;
+
+	char pad0[MODP_CACHE_LINE];
+
+	// producer
+	_Atomic unsigned int writepos;
+	unsigned int playpos_cache;
+
+	char pad1[MODP_CACHE_LINE];
 
-	_Atomic int size,
-	            reserve;
+	// consumer
+	_Atomic unsigned int playpos;
+	unsigned int writepos_cache;
 
-	_Atomic int playpos,
-	            writepos;
+	char pad2[MODP_CACHE_LINE];
 } RingBuffer;
 
-static RingBuffer* RingBuffer_Create        (int, int);
+// A region of the ring, split in two where it wraps around. The second
+// part is empty when the region is contiguous.
+typedef struct RingBuffer_Span {
+	void* ptr[2];
+	int len[2];
+} RingBuffer_Span;
+
+static RingBuffer* RingBuffer_Create        (int, size_t);
 static void        RingBuffer_ConsumerClear (RingBuffer*);
+static void        RingBuffer_ConsumerSkip  (RingBuffer*, unsigned int);
+static unsigned int RingBuffer_WritePos     (RingBuffer*);
 static void        RingBuffer_Destroy       (RingBuffer*);
 static int         RingBuffer_Count         (const RingBuffer*);
-static int         RingBuffer_Write         (RingBuffer*, const T*, int);
-static int         RingBuffer_Read          (RingBuffer*, T*, int);
+static int         RingBuffer_WriteReserve  (RingBuffer*, int, RingBuffer_Span*);
+static void        RingBuffer_WriteCommit   (RingBuffer*, int);
+static int         RingBuffer_ReadPeek      (RingBuffer*, int, RingBuffer_Span*);
+static void        RingBuffer_ReadRelease   (RingBuffer*, int);
+static int         RingBuffer_Write         (RingBuffer*, const void*, int);
+static int         RingBuffer_Read          (RingBuffer*, void*, int);
 
 static RingBuffer*
 RingBuffer_Create(int size,
-                  int reserve)
+                  size_t elem)
 {
 	RingBuffer* rb = (RingBuffer*) calloc(1, sizeof(RingBuffer));
 	assert(rb);
 
-	rb->playpos = rb->writepos = 0;
-	rb->reserve = reserve;
-	rb->size = size + reserve;
+	assert(size > 0 && size <= (1 << 30));
+	assert(elem > 0);
+
+	rb->size = 1;
+
+	while (rb->size < (unsigned int) size)
+		rb->size <<= 1;
+
+	rb->mask = rb->size - 1;
+	rb->elem = elem;
 
-	assert(rb->size > 0);
+	atomic_init(&rb->writepos, 0);
+	atomic_init(&rb->playpos, 0);
+	rb->playpos_cache = rb->writepos_cache = 0;
 
-	rb->buffer = (T*) calloc(rb->size, sizeof(T));
+	rb->buffer = calloc(rb->size, elem);
 	assert(rb->buffer);
 
 	return rb;
@@ -54,9 +92,35 @@ RingBuffer_Create(int size,
 static void
 RingBuffer_ConsumerClear(RingBuffer* rb)
 {
-	int n = RingBuffer_Count(rb);
+	unsigned int w = atomic_load_explicit(&rb->writepos, memory_order_acquire);
 
-	rb->playpos = (rb->playpos + n) % rb->size;
+	rb->writepos_cache = w;
+	atomic_store_explicit(&rb->playpos, w, memory_order_release);
+}
+
+// Consumer: drops everything before pos, a value previously returned by
+// RingBuffer_WritePos. Does nothing if that is already consumed.
+static void
+RingBuffer_ConsumerSkip(RingBuffer* rb,
+                        unsigned int pos)
+{
+	unsigned int r = atomic_load_explicit(&rb->playpos, memory_order_relaxed);
+
+	if ((int) (pos - r) <= 0)
+		return;
+
+	// pos was written, so it is a valid snapshot of the producer position
+	if ((int) (pos - rb->writepos_cache) > 0)
+		rb->writepos_cache = pos;
+
+	atomic_store_explicit(&rb->playpos, pos, memory_order_release);
+}
+
+// Producer: the position the next committed sample will be written at.
+static unsigned int
+RingBuffer_WritePos(RingBuffer* rb)
+{
+	return atomic_load_explicit(&rb->writepos, memory_order_relaxed);
 }
 
 static void
@@ -72,54 +136,126 @@ RingBuffer_Destroy(RingBuffer* rb)
 static int
 RingBuffer_Count(const RingBuffer* rb)
 {
-	int diff = rb->writepos - rb->playpos;
-	return diff < 0 ? rb->size + diff : diff;
+	unsigned int r = atomic_load_explicit(&rb->playpos, memory_order_acquire);
+	unsigned int w = atomic_load_explicit(&rb->writepos, memory_order_acquire);
+
+	return (int) (w - r);
+}
+
+static void
+RingBuffer_MakeSpan(const RingBuffer* rb,
+                    unsigned int pos,
+                    int n,
+                    RingBuffer_Span* span)
+{
+	unsigned int ofs = pos & rb->mask;
+	int first = min_int(n, rb->size - ofs);
+
+	span->ptr[0] = (char*) rb->buffer + ofs * rb->elem;
+	span->len[0] = first;
+	span->ptr[1] = rb->buffer;
+	span->len[1] = n - first;
 }
 
+// Producer: reserves up to n samples of free space for writing in place,
+// returns the number reserved. Nothing is visible to the consumer until
+// RingBuffer_WriteCommit.
 static int
-RingBuffer_Write(RingBuffer* rb,
-                 const T* src,
-                 int n)
+RingBuffer_WriteReserve(RingBuffer* rb,
+                        int n,
+                        RingBuffer_Span* span)
 {
-	n = min_int(n, rb->size - rb->reserve - RingBuffer_Count(rb));
+	unsigned int w = atomic_load_explicit(&rb->writepos, memory_order_relaxed);
+	unsigned int space = rb->size - (w - rb->playpos_cache);
+
+	if (space < (unsigned int) n) {
+		rb->playpos_cache = atomic_load_explicit(&rb->playpos,
+		                                         memory_order_acquire);
+		space = rb->size - (w - rb->playpos_cache);
+	}
+
+	n = min_int(n, (int) space);
 	n = n < 0 ? 0 : n;
 
-	if (rb->writepos + n > rb->size) {
-		memcpy(rb->buffer + rb->writepos,
-		       src,
-		       sizeof(T) * (rb->size - rb->writepos));
-		memcpy(rb->buffer,
-		       src + (rb->size - rb->writepos),
-		       sizeof(T) * (n - (rb->size - rb->writepos)));
-	} else {
-		memcpy(rb->buffer + rb->writepos, src, sizeof(T) * n);
+	RingBuffer_MakeSpan(rb, w, n, span);
+
+	return n;
+}
+
+static void
+RingBuffer_WriteCommit(RingBuffer* rb,
+                       int n)
+{
+	unsigned int w = atomic_load_explicit(&rb->writepos, memory_order_relaxed);
+
+	atomic_store_explicit(&rb->writepos, w + n, memory_order_release);
+}
+
+// Consumer: exposes up to n readable samples in place, returns the number
+// exposed. They stay in the ring until RingBuffer_ReadRelease.
+static int
+RingBuffer_ReadPeek(RingBuffer* rb,
+                    int n,
+                    RingBuffer_Span* span)
+{
+	unsigned int r = atomic_load_explicit(&rb->playpos, memory_order_relaxed);
+	unsigned int avail = rb->writepos_cache - r;
+
+	if (avail < (unsigned int) n) {
+		rb->writepos_cache = atomic_load_explicit(&rb->writepos,
+		                                          memory_order_acquire);
+		avail = rb->writepos_cache - r;
 	}
 
-	rb->writepos = (rb->writepos + n) % rb->size;
+	n = min_int(n, (int) avail);
+	n = n < 0 ? 0 : n;
+
+	RingBuffer_MakeSpan(rb, r, n, span);
+
+	return n;
+}
+
+static void
+RingBuffer_ReadRelease(RingBuffer* rb,
+                       int n)
+{
+	unsigned int r = atomic_load_explicit(&rb->playpos, memory_order_relaxed);
+
+	atomic_store_explicit(&rb->playpos, r + n, memory_order_release);
+}
+
+static int
+RingBuffer_Write(RingBuffer* rb,
+                 const void* src,
+                 int n)
+{
+	RingBuffer_Span span;
+
+	n = RingBuffer_WriteReserve(rb, n, &span);
+
+	memcpy(span.ptr[0], src, rb->elem * span.len[0]);
+	memcpy(span.ptr[1], (const char*) src + rb->elem * span.len[0],
+	       rb->elem * span.len[1]);
+
+	RingBuffer_WriteCommit(rb, n);
 
 	return n;
 }
 
 static int
 RingBuffer_Read(RingBuffer* rb,
-                T* dst,
+                void* dst,
                 int n)
 {
-	n = min_int(n, RingBuffer_Count(rb));
-	n = n < 0 ? 0 : n;
+	RingBuffer_Span span;
 
-	if (rb->playpos + n > rb->size) {
-		memcpy(dst,
-		       rb->buffer + rb->playpos,
-		       sizeof(T) * (rb->size - rb->playpos));
-		memcpy(dst + (rb->size - rb->playpos),
-		       rb->buffer,
-		       sizeof(T) * (n - (rb->size - rb->playpos)));
-	} else {
-		memcpy(dst, rb->buffer + rb->playpos, sizeof(T) * n);
-	}
+	n = RingBuffer_ReadPeek(rb, n, &span);
+
+	memcpy(dst, span.ptr[0], rb->elem * span.len[0]);
+	memcpy((char*) dst + rb->elem * span.len[0], span.ptr[1],
+	       rb->elem * span.len[1]);
 
-	rb->playpos = (rb->playpos + n) % rb->size;
+	RingBuffer_ReadRelease(rb, n);
 
 	return n;
 }
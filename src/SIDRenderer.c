@@ -7,18 +7,55 @@
 #include <malloc.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "../3rdparty/libsidplayfp/libsidplayfp_wrap.h"
 #include "SIDRenderer.h"
+#include "MD5.h"
+#include "Sample.h"
+#include "MinMax.h"
 #include "Globals.h"
 
+// frames a seek renders and discards at a time
+#define SID_SEEK_FRAMES (1024)
+// frames the engine is run for at a time, the size the conversions and the
+// resampler work in
+#define SID_CHUNK_FRAMES (SAMPLE_CHUNK)
+
+typedef struct SIDRenderer_ModeDesc {
+	const char* name;
+	SidEmulation emulation;
+	SidSampling sampling;
+} SIDRenderer_ModeDesc;
+
+// most expensive first, the quality levels step down this list, past the
+// modes this libsidplayfp has no engine for
+static const SIDRenderer_ModeDesc SIDRenderer_Modes[SIDM_COUNT] = {
+	[SIDM_RESIDFP_RESAMPLE] = { "residfp-resample", SID_EMU_RESIDFP, SID_SAMPLING_RESAMPLE },
+	[SIDM_RESIDFP]          = { "residfp", SID_EMU_RESIDFP, SID_SAMPLING_INTERPOLATE },
+	[SIDM_RESIDFP_FAST]     = { "residfp-fast", SID_EMU_RESIDFP, SID_SAMPLING_FAST },
+	[SIDM_RESID]            = { "resid", SID_EMU_RESID, SID_SAMPLING_INTERPOLATE },
+	[SIDM_RESID_FAST]       = { "resid-fast", SID_EMU_RESID, SID_SAMPLING_FAST },
+	[SIDM_AUTO]             = { "auto", SID_EMU_RESIDFP, SID_SAMPLING_INTERPOLATE }
+};
+
 typedef struct SIDRenderer_Data {
-	struct ReSIDfpBuilder* resid_builder;
 	struct SidTune* sid_tune;
 	struct sidplayfp* sid_engine;
 	char title[MODP_STR_LENGTH];
 	char info[MODP_STR_LENGTH];
+	uint8_t md5[MD5_DIGEST_LEN];
+	// engine output past the end of the last render
+	int16_t* carry;
+	size_t carry_index;
+	size_t carry_len;
+	bool stopped;
 	_Atomic size_t total_frames_rendered;
+	// the mode the tune was loaded with, the one it plays with, and the
+	// one it moves to at the next song start
+	int base_mode,
+	    mode,
+	    next_mode;
 	unsigned int songs;
 	int current_track;
 	int track_length;
@@ -30,6 +67,12 @@ typedef struct SIDRenderer_Data {
 	assert((a)); \
 	DebugPrint((b));
 
+// shared by every instance, only read once set
+static const SongLengths* SIDRenderer_SongLengths = NULL;
+static SIDRenderer_Mode SIDRenderer_ModeSetting = SIDM_AUTO;
+// the engine pool is freed along with the last instance
+static _Atomic int SIDRenderer_Instances = 0;
+
 static void SIDRenderer_UnLoad(const AudioRenderer*);
 static int  SIDRenderer_SetTrack(const AudioRenderer*, int);
 void SIDRenderer_DeleteInterfaces(const AudioRenderer*);
@@ -41,18 +84,66 @@ SIDRenderer_LogFunc(const char* message)
 		fprintf(stderr, "SIDRenderer: %s\n", message);
 }
 
+static bool
+SIDRenderer_ModeAvailable(int mode)
+{
+	return mode == SIDM_AUTO
+	       || hasSidEmulation(SIDRenderer_Modes[mode].emulation);
+}
+
+// The mode level steps below from, or the cheapest one there is.
+static int
+SIDRenderer_StepMode(int from, int level)
+{
+	int mode = from;
+
+	for (int m = from + 1; m < SIDM_AUTO && level > 0; m++) {
+		if (SIDRenderer_ModeAvailable(m)) {
+			mode = m;
+			level--;
+		}
+	}
+
+	return mode;
+}
+
+// How many steps mode is below from.
+static int
+SIDRenderer_ModeLevel(int from, int mode)
+{
+	int level = 0;
+
+	for (int m = from + 1; m <= mode; m++)
+		level += SIDRenderer_ModeAvailable(m);
+
+	return level;
+}
+
 static int
 SIDRenderer_Load(const AudioRenderer* obj,
                  const char* filename,
                  const void* data,
-                 const size_t len)
+                 const size_t len,
+                 void* prepared)
 {
+	const SIDRenderer_ModeDesc* desc;
+
+	(void) prepared;
+
 	DataObject(rndr_data, obj);
-	rndr_data->resid_builder = newReSIDfpBuilder();
-	rndr_data->sid_engine = newSidEngine();
 	rndr_data->sid_tune = newSidTune(data, len);
 
-	if (!initSidEngine(rndr_data->sid_engine, rndr_data->resid_builder, rndr_data->channels, rndr_data->fs)) {
+	if (SIDRenderer_ModeSetting == SIDM_AUTO)
+		rndr_data->mode = SIDM_RESIDFP;
+	else
+		rndr_data->mode = SIDRenderer_ModeSetting;
+
+	rndr_data->base_mode = rndr_data->next_mode = rndr_data->mode;
+	desc = &SIDRenderer_Modes[rndr_data->mode];
+	rndr_data->sid_engine = acquireSidEngine(rndr_data->channels, rndr_data->fs,
+	                                         desc->emulation, desc->sampling);
+
+	if (rndr_data->sid_engine == NULL) {
 		SIDRenderer_LogFunc("error initializing libsidplayfp engine");
 		SIDRenderer_DeleteInterfaces(obj);
 		return 1;
@@ -65,6 +156,8 @@ SIDRenderer_Load(const AudioRenderer* obj,
 	}
 
 	rndr_data->songs = songsSidTune(rndr_data->sid_tune);
+	// HVSC keys its song lengths on the MD5 of the whole file
+	MD5_Sum(data, len, rndr_data->md5);
 	assert(memccpy(rndr_data->title, filename, '\0', MODP_STR_LENGTH) != NULL);
 	return SIDRenderer_SetTrack(obj, 0);
 }
@@ -72,10 +165,9 @@ SIDRenderer_Load(const AudioRenderer* obj,
 void SIDRenderer_DeleteInterfaces(const AudioRenderer* obj)
 {
 	DataObject(rndr_data, obj);
-	deleteReSIDfpBuilder(rndr_data->resid_builder);
-	deleteSideEngine(rndr_data->sid_engine);
+	// the engine goes back to the pool, and lets go of the tune
+	releaseSidEngine(rndr_data->sid_engine);
 	deleteSidTune(rndr_data->sid_tune);
-	rndr_data->resid_builder = NULL;
 	rndr_data->sid_engine = NULL;
 	rndr_data->sid_tune = NULL;
 }
@@ -83,9 +175,11 @@ void SIDRenderer_DeleteInterfaces(const AudioRenderer* obj)
 static bool
 SIDRenderer_CanLoad(const AudioRenderer* obj,
                     const void* data,
-                    const size_t len)
+                    const size_t len,
+                    void** prepared)
 {
 	(void) obj;
+	(void) prepared;
 	// check for 4B sid magic id in file header
 	if (len > 4 && (!memcmp(data, "PSID", 4) || !memcmp(data, "RSID", 4))) {
 		return true;
@@ -93,6 +187,22 @@ SIDRenderer_CanLoad(const AudioRenderer* obj,
 	return false;
 }
 
+// sidplayfp reads PSID and RSID files
+static const AudioRenderer_Sig SIDRenderer_SigTable[] = {
+	{ "PSID", 0, 4, NULL, ARC_CERTAIN },
+	{ "RSID", 0, 4, NULL, ARC_CERTAIN },
+	{ NULL, 0, 0, "sid", ARC_EXT },
+	{ NULL, 0, 0, NULL, ARC_NONE }
+};
+
+static const AudioRenderer_Sig*
+SIDRenderer_Sigs(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return SIDRenderer_SigTable;
+}
+
 static bool
 SIDRenderer_Loaded(const AudioRenderer* obj)
 {
@@ -113,27 +223,114 @@ SIDRenderer_UnLoad(const AudioRenderer* obj)
 	rndr_data->current_track = -1;
 	rndr_data->track_length = -1;
 	rndr_data->total_frames_rendered = 0;
+	rndr_data->carry_index = rndr_data->carry_len = 0;
+	rndr_data->stopped = false;
 	rndr_data->songs = 0;
 }
 
+// Whole chunks are played straight into buf, only a chunk split by the
+// end of buf goes through the carry buffer. The engine only returns short
+// when it fails, so the rest is silence then rather than another try.
+static void
+SIDRenderer_RenderS16(void* user, int16_t* buf, size_t frames)
+{
+	SIDRenderer_Data* rndr_data = (SIDRenderer_Data*) user;
+	int ch = rndr_data->channels;
+	size_t pos;
+
+	// flush what the engine produced past the previous call
+	pos = min_size(rndr_data->carry_len - rndr_data->carry_index, frames);
+	memcpy(buf, rndr_data->carry + rndr_data->carry_index * ch,
+	       pos * ch * sizeof(int16_t));
+	rndr_data->carry_index += pos;
+
+	while (pos < frames && !rndr_data->stopped) {
+		size_t n = frames - pos;
+		size_t got;
+
+		if (n >= SID_CHUNK_FRAMES) {
+			n -= n % SID_CHUNK_FRAMES;
+			got = playSidEngine(rndr_data->sid_engine,
+			                    buf + pos * ch, n * ch) / ch;
+		} else {
+			got = playSidEngine(rndr_data->sid_engine, rndr_data->carry,
+			                    SID_CHUNK_FRAMES * ch) / ch;
+
+			rndr_data->carry_len = got;
+			rndr_data->carry_index = got = min_size(got, n);
+			memcpy(buf + pos * ch, rndr_data->carry, got * ch * sizeof(int16_t));
+		}
+
+		if (got < n) {
+			SIDRenderer_LogFunc("engine stopped");
+			rndr_data->stopped = true;
+		}
+
+		pos += got;
+	}
+
+	memset(buf + pos * ch, 0, (frames - pos) * ch * sizeof(int16_t));
+}
+
+// Plays frames of the song and throws the audio away.
+static void
+SIDRenderer_Skip(SIDRenderer_Data* rndr_data, size_t frames)
+{
+	int16_t scratch[SID_SEEK_FRAMES * 2];
+
+	while (frames > 0) {
+		size_t n = min_size(frames, SID_SEEK_FRAMES);
+
+		SIDRenderer_RenderS16(rndr_data, scratch, n);
+		frames -= n;
+	}
+}
+
+// Moves the tune to an engine set up for next_mode, before a song is
+// loaded. A new engine starts the song over, and playing it up to where
+// the old one was would take too long while rendering, so this is only
+// done where a song starts.
+static void
+SIDRenderer_SwitchMode(SIDRenderer_Data* rndr_data)
+{
+	const SIDRenderer_ModeDesc* desc = &SIDRenderer_Modes[rndr_data->next_mode];
+	struct sidplayfp* engine;
+
+	if (rndr_data->next_mode == rndr_data->mode)
+		return;
+
+	engine = acquireSidEngine(rndr_data->channels, rndr_data->fs,
+	                          desc->emulation, desc->sampling);
+
+	// stays with the engine it has
+	if (engine == NULL) {
+		SIDRenderer_LogFunc("error initializing libsidplayfp engine");
+		rndr_data->next_mode = rndr_data->mode;
+		return;
+	}
+
+	releaseSidEngine(rndr_data->sid_engine);
+	rndr_data->sid_engine = engine;
+	rndr_data->mode = rndr_data->next_mode;
+}
+
 static int
 SIDRenderer_Render(const AudioRenderer* obj,
                    void* buf,
                    const size_t len)
 {
 	DataObject(rndr_data, obj);
-	int16_t* rndr_buf = (int16_t*) buf;
-	size_t rendered = 0;
-	size_t to_render = rndr_data->fs / rndr_data->channels;
-		
-	while (rendered < to_render) {
-		rendered += playSidEngine(rndr_data->sid_engine, rndr_buf, to_render);
-	}
+	size_t frames = len / Sample_FrameBytes(rndr_data->bits,
+	                                        rndr_data->channels);
+
+	// the engine is set up with the channel count, only the sample
+	// format is converted
+	Sample_RenderS16(SIDRenderer_RenderS16, rndr_data, rndr_data->channels,
+	                 buf, rndr_data->bits, rndr_data->channels, frames);
 
-	assert(((int) rendered - to_render) == 0);
-	rndr_data->total_frames_rendered += rendered / rndr_data->channels;
+	rndr_data->total_frames_rendered += frames;
 
-	return rendered;
+	return frames * rndr_data->channels;
 }
 
 static const char*
@@ -208,11 +405,29 @@ SIDRenderer_SetTrack(const AudioRenderer* obj, int track)
 			return -1;
 		}
 
+		SIDRenderer_SwitchMode(rndr_data);
+
 		if (!loadSidTune(rndr_data->sid_tune, rndr_data->sid_engine)) {
 			SIDRenderer_LogFunc("failed to load song");
 			return -1;
 		}
 
+		rndr_data->total_frames_rendered = 0;
+		rndr_data->carry_index = rndr_data->carry_len = 0;
+		rndr_data->stopped = false;
+		rndr_data->track_length = -1;
+
+		// the database counts from the first song, track 0 is the start
+		// song of the tune
+		if (SIDRenderer_SongLengths != NULL) {
+			int ms = SongLengths_Find(SIDRenderer_SongLengths, rndr_data->md5,
+			                          currentSongSidTune(rndr_data->sid_tune) - 1);
+
+			if (ms > 0)
+				rndr_data->track_length = (int) ((int64_t) ms
+				                                 * rndr_data->fs / 1000);
+		}
+
 		infostr_len = numberOfInfoStringsSidTune(rndr_data->sid_tune) - 1;
 
 		for (size_t i = 0; i <= infostr_len; i++) {
@@ -245,10 +460,7 @@ static int
 SIDRenderer_Length(const AudioRenderer* obj)
 {
 	DataObject(rndr_data, obj);
-	/* todo:  sids do not set track length, 
-	* hvsc provides a db: https://www.hvsc.c64.org/download/C64Music/DOCUMENTS/Songlengths.txt
-	* perhaps some libcurl fetch, store and use
-	*/
+	// tunes not in the HVSC song length database play on
 	if (rndr_data->sid_engine) {
 		if (rndr_data->track_length < 0)
 			return (int) rndr_data->total_frames_rendered / rndr_data->fs + 1;
@@ -259,6 +471,86 @@ SIDRenderer_Length(const AudioRenderer* obj)
 	return 0;
 }
 
+// tunes never end by themselves, only an engine that failed stops
+static bool
+SIDRenderer_Ended(const AudioRenderer* obj)
+{
+	DataObject(rndr_data, obj);
+
+	return rndr_data->sid_tune != NULL && rndr_data->stopped;
+}
+
+// sidplayfp has no seek, so the song is played up to the position and the
+// audio discarded, a seek back starts the song over first.
+static int
+SIDRenderer_Seek(const AudioRenderer* obj, int ms)
+{
+	size_t target, pos;
+
+	DataObject(rndr_data, obj);
+
+	if (rndr_data->sid_tune == NULL)
+		return -1;
+
+	target = (size_t) ms * rndr_data->fs / 1000;
+
+	if (target < rndr_data->total_frames_rendered
+	        && SIDRenderer_SetTrack(obj, rndr_data->current_track) < 0)
+		return -1;
+
+	pos = rndr_data->total_frames_rendered;
+
+	if (pos < target) {
+		SIDRenderer_Skip(rndr_data, target - pos);
+		pos = target;
+	}
+
+	rndr_data->total_frames_rendered = pos;
+
+	return (int) (pos * 1000 / rndr_data->fs);
+}
+
+static bool
+SIDRenderer_CanSeekFast(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return false;
+}
+
+// Levels are the modes below the one the tune was loaded with, a mode set
+// with -j is kept. Before anything is rendered the engine is switched
+// right away, later the mode is taken at the next song start, and only one
+// step further down than the engine playing is taken meanwhile, since the
+// render cost does not show the steps not taken yet.
+static int
+SIDRenderer_SetQuality(const AudioRenderer* obj, int level)
+{
+	int mode;
+
+	DataObject(rndr_data, obj);
+
+	if (rndr_data->sid_tune == NULL || SIDRenderer_ModeSetting != SIDM_AUTO)
+		return 0;
+
+	mode = SIDRenderer_StepMode(rndr_data->base_mode, max_int(level, 0));
+
+	if (rndr_data->total_frames_rendered > 0) {
+		rndr_data->next_mode = min_int(mode,
+		                               SIDRenderer_StepMode(rndr_data->mode, 1));
+	} else if (mode != rndr_data->mode && !rndr_data->stopped) {
+		rndr_data->next_mode = mode;
+		SIDRenderer_SwitchMode(rndr_data);
+
+		if (!loadSidTune(rndr_data->sid_tune, rndr_data->sid_engine)) {
+			SIDRenderer_LogFunc("failed to load song");
+			rndr_data->stopped = true;
+		}
+	}
+
+	return SIDRenderer_ModeLevel(rndr_data->base_mode, rndr_data->next_mode);
+}
+
 static void
 SIDRenderer_Destroy(AudioRenderer* obj)
 {
@@ -266,8 +558,52 @@ SIDRenderer_Destroy(AudioRenderer* obj)
 
 	SIDRenderer_UnLoad((const AudioRenderer*) obj);
 
+	free(rndr_data->carry);
 	free(rndr_data);
 	free(obj);
+
+	if (atomic_fetch_sub(&SIDRenderer_Instances, 1) == 1)
+		freeSidEnginePool();
+}
+
+// The HVSC song length database, NULL if none. Only to be set while no
+// renderer is loading.
+void
+SIDRenderer_SetSongLengths(const SongLengths* sl)
+{
+	SIDRenderer_SongLengths = sl;
+}
+
+// The emulation and sampling the engines are set up with, SIDM_AUTO to
+// start at reSIDfp and let the quality level pick cheaper ones. Only
+// to be set while no renderer is loading.
+void
+SIDRenderer_SetMode(SIDRenderer_Mode mode)
+{
+	assert(mode >= 0 && mode < SIDM_COUNT);
+	assert(SIDRenderer_ModeAvailable(mode));
+
+	SIDRenderer_ModeSetting = mode;
+}
+
+const char*
+SIDRenderer_ModeName(SIDRenderer_Mode mode)
+{
+	assert(mode >= 0 && mode < SIDM_COUNT);
+
+	return SIDRenderer_Modes[mode].name;
+}
+
+// The mode by its name, -1 for an unknown one or one this libsidplayfp
+// has no engine for.
+int
+SIDRenderer_ParseMode(const char* name)
+{
+	for (int m = 0; m < SIDM_COUNT; m++)
+		if (strcmp(name, SIDRenderer_Modes[m].name) == 0)
+			return SIDRenderer_ModeAvailable(m) ? m : -1;
+
+	return -1;
 }
 
 AudioRenderer*
@@ -284,6 +620,7 @@ SIDRenderer_Create(int fs, int bits, int channels)
 
 		_vtable.Load     = (*SIDRenderer_Load);
 		_vtable.CanLoad  = (*SIDRenderer_CanLoad);
+		_vtable.Sigs     = (*SIDRenderer_Sigs);
 		_vtable.Loaded   = (*SIDRenderer_Loaded);
 		_vtable.UnLoad   = (*SIDRenderer_UnLoad);
 		_vtable.Render   = (*SIDRenderer_Render);
@@ -294,6 +631,10 @@ SIDRenderer_Create(int fs, int bits, int channels)
 		_vtable.SetTrack = (*SIDRenderer_SetTrack);
 		_vtable.PlayTime = (*SIDRenderer_PlayTime);
 		_vtable.Length   = (*SIDRenderer_Length);
+		_vtable.Ended    = (*SIDRenderer_Ended);
+		_vtable.Seek     = (*SIDRenderer_Seek);
+		_vtable.CanSeekFast = (*SIDRenderer_CanSeekFast);
+		_vtable.SetQuality = (*SIDRenderer_SetQuality);
 		_vtable.Destroy  = (*SIDRenderer_Destroy);
 
 		_initialized = true;
@@ -302,15 +643,21 @@ SIDRenderer_Create(int fs, int bits, int channels)
 	arndr = (AudioRenderer*) calloc(1, sizeof(AudioRenderer));
 	assert(arndr);
 
+	atomic_fetch_add(&SIDRenderer_Instances, 1);
+
 	rndr_data = (SIDRenderer_Data*) calloc(1, sizeof(SIDRenderer_Data));
 	assert(rndr_data);
 
 	rndr_data->fs = fs;
 	rndr_data->bits = bits;
 	rndr_data->channels = channels;
-	rndr_data->resid_builder = NULL;
 	rndr_data->sid_tune = NULL;
 	rndr_data->sid_engine = NULL;
+	rndr_data->base_mode = rndr_data->mode = rndr_data->next_mode = SIDM_RESIDFP;
+
+	rndr_data->carry = (int16_t*) calloc(SID_CHUNK_FRAMES * channels,
+	                                     sizeof(int16_t));
+	assert(rndr_data->carry);
 
 	rndr_data->current_track = -1;
 	rndr_data->track_length = -1;
@@ -6,6 +6,21 @@
 
 #include "AudioRenderer.h"
 #include "RingBuffer.h"
+#include "SongLengths.h"
+
+typedef enum SIDRenderer_Mode {
+	SIDM_RESIDFP_RESAMPLE,
+	SIDM_RESIDFP,
+	SIDM_RESIDFP_FAST,
+	SIDM_RESID,
+	SIDM_RESID_FAST,
+	SIDM_AUTO,
+	SIDM_COUNT
+} SIDRenderer_Mode;
 
 AudioRenderer* SIDRenderer_Create(int, int, int);
+void           SIDRenderer_SetSongLengths(const SongLengths*);
+void           SIDRenderer_SetMode(SIDRenderer_Mode);
+const char*    SIDRenderer_ModeName(SIDRenderer_Mode);
+int            SIDRenderer_ParseMode(const char*);
 #endif /* SRC_SIDRENDERER_H_ */
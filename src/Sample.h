@@ -0,0 +1,145 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_SAMPLE_H_
+#define SRC_SAMPLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+// Sample formats of the pipeline, 16 bits is signed integer and 32 bits
+// is float in [-1, 1]. Samples are interleaved, 1 or 2 channels.
+#define SAMPLE_S16       (16)
+#define SAMPLE_F32       (32)
+#define SAMPLE_MIN_FS    (8000)
+#define SAMPLE_MAX_FS    (192000)
+#define SAMPLE_MAX_CH    (2)
+#define SAMPLE_CHUNK     (512)
+
+static inline bool
+Sample_ValidFormat(int fs, int bits, int channels)
+{
+	return fs >= SAMPLE_MIN_FS && fs <= SAMPLE_MAX_FS
+	       && (bits == SAMPLE_S16 || bits == SAMPLE_F32)
+	       && channels >= 1 && channels <= SAMPLE_MAX_CH;
+}
+
+static inline size_t
+Sample_Bytes(int bits)
+{
+	return bits == SAMPLE_F32 ? sizeof(float) : sizeof(int16_t);
+}
+
+static inline size_t
+Sample_FrameBytes(int bits, int channels)
+{
+	return Sample_Bytes(bits) * channels;
+}
+
+// Converts frames of src_channels int16 into the given format, mono is
+// downmixed by averaging and duplicated to reach stereo.
+static inline void
+Sample_FromS16(void* dst,
+               int bits,
+               int channels,
+               const int16_t* src,
+               int src_channels,
+               size_t frames)
+{
+	for (size_t i = 0; i < frames; i++) {
+		const int16_t* s = src + i * src_channels;
+
+		for (int c = 0; c < channels; c++) {
+			int v;
+
+			if (channels == src_channels)
+				v = s[c];
+			else if (src_channels == 2)
+				v = (s[0] + s[1]) / 2;
+			else
+				v = s[0];
+
+			if (bits == SAMPLE_S16)
+				((int16_t*) dst)[i * channels + c] = (int16_t) v;
+			else
+				((float*) dst)[i * channels + c] = v * (1.f / 32768.f);
+		}
+	}
+}
+
+// Converts n float samples into the given format, clipping for int16.
+static inline void
+Sample_FromFloat(void* dst,
+                 int bits,
+                 const float* src,
+                 size_t n)
+{
+	if (bits == SAMPLE_F32) {
+		memcpy(dst, src, n * sizeof(float));
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		float f = src[i] * 32768.f;
+
+		((int16_t*) dst)[i] = f >= 32767.f ? 32767
+		                      : f <= -32768.f ? -32768 : (int16_t) lrintf(f);
+	}
+}
+
+// Converts frames into float stereo, as used by the playback tap.
+static inline void
+Sample_ToFloatStereo(float* dst,
+                     const void* src,
+                     int bits,
+                     int channels,
+                     size_t frames)
+{
+	for (size_t i = 0; i < frames; i++) {
+		for (int c = 0; c < 2; c++) {
+			size_t j = i * channels + (channels == 2 ? c : 0);
+
+			if (bits == SAMPLE_S16)
+				dst[i * 2 + c] = ((const int16_t*) src)[j] * (1.f / 32768.f);
+			else
+				dst[i * 2 + c] = ((const float*) src)[j];
+		}
+	}
+}
+
+// Renders through an int16 source, for the libraries without a native
+// output in every format. The source writes frames of src_channels.
+typedef void (*Sample_S16Func)(void* user, int16_t* buf, size_t frames);
+
+static inline void
+Sample_RenderS16(Sample_S16Func func,
+                 void* user,
+                 int src_channels,
+                 void* dst,
+                 int bits,
+                 int channels,
+                 size_t frames)
+{
+	int16_t tmp[SAMPLE_CHUNK * SAMPLE_MAX_CH];
+	size_t frame_bytes = Sample_FrameBytes(bits, channels);
+
+	if (bits == SAMPLE_S16 && channels == src_channels) {
+		func(user, (int16_t*) dst, frames);
+		return;
+	}
+
+	while (frames > 0) {
+		size_t n = frames < SAMPLE_CHUNK ? frames : SAMPLE_CHUNK;
+
+		func(user, tmp, n);
+		Sample_FromS16(dst, bits, channels, tmp, src_channels, n);
+
+		dst = (char*) dst + n * frame_bytes;
+		frames -= n;
+	}
+}
+
+#endif /* SRC_SAMPLE_H_ */
@@ -0,0 +1,269 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "SilenceDetector.h"
+
+typedef struct SilenceDetector_Stats {
+	float sum[SAMPLE_MAX_CH],
+	      sum_sq[SAMPLE_MAX_CH],
+	      max[SAMPLE_MAX_CH],
+	      min[SAMPLE_MAX_CH];
+} SilenceDetector_Stats;
+
+static inline float
+SilenceDetector_Get(const void* buf, int bits, size_t i)
+{
+	if (bits == SAMPLE_F32)
+		return ((const float*) buf)[i];
+
+	return ((const int16_t*) buf)[i] * (1.f / 32768.f);
+}
+
+static void
+SilenceDetector_StatsScalar(const void* buf,
+                            int bits,
+                            int channels,
+                            size_t ofs,
+                            size_t n,
+                            SilenceDetector_Stats* st)
+{
+	for (size_t i = ofs; i < n; i++) {
+		int c = i % channels;
+		float v = SilenceDetector_Get(buf, bits, i);
+
+		st->sum[c] += v;
+		st->sum_sq[c] += v * v;
+		st->max[c] = v > st->max[c] ? v : st->max[c];
+		st->min[c] = v < st->min[c] ? v : st->min[c];
+	}
+}
+
+#if defined(__SSE2__)
+// Four samples at a time, the lanes hold L R L R for stereo and the only
+// channel for mono, so they are folded back per channel at the end.
+static void
+SilenceDetector_StatsSSE2(const void* buf,
+                          int bits,
+                          int channels,
+                          size_t n,
+                          SilenceDetector_Stats* st)
+{
+	const float scale = 1.f / 32768.f;
+	__m128 sum = _mm_setzero_ps();
+	__m128 sum_sq = _mm_setzero_ps();
+	__m128 vmax = _mm_set1_ps(-INFINITY);
+	__m128 vmin = _mm_set1_ps(INFINITY);
+	float l_sum[4], l_sum_sq[4], l_max[4], l_min[4];
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128 v;
+
+		if (bits == SAMPLE_F32) {
+			v = _mm_loadu_ps((const float*) buf + i);
+		} else {
+			__m128i s = _mm_loadl_epi64((const __m128i*) ((const int16_t*) buf + i));
+
+			s = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+			v = _mm_mul_ps(_mm_cvtepi32_ps(s), _mm_set1_ps(scale));
+		}
+
+		sum = _mm_add_ps(sum, v);
+		sum_sq = _mm_add_ps(sum_sq, _mm_mul_ps(v, v));
+		vmax = _mm_max_ps(vmax, v);
+		vmin = _mm_min_ps(vmin, v);
+	}
+
+	_mm_storeu_ps(l_sum, sum);
+	_mm_storeu_ps(l_sum_sq, sum_sq);
+	_mm_storeu_ps(l_max, vmax);
+	_mm_storeu_ps(l_min, vmin);
+
+	for (int l = 0; l < 4; l++) {
+		int c = l % channels;
+
+		st->sum[c] += l_sum[l];
+		st->sum_sq[c] += l_sum_sq[l];
+		st->max[c] = l_max[l] > st->max[c] ? l_max[l] : st->max[c];
+		st->min[c] = l_min[l] < st->min[c] ? l_min[l] : st->min[c];
+	}
+
+	SilenceDetector_StatsScalar(buf, bits, channels, i, n, st);
+}
+#endif
+
+static void
+SilenceDetector_GetStats(const void* buf,
+                         int bits,
+                         int channels,
+                         size_t n,
+                         SilenceDetector_Stats* st)
+{
+	for (int c = 0; c < SAMPLE_MAX_CH; c++) {
+		st->sum[c] = st->sum_sq[c] = 0.f;
+		st->max[c] = -INFINITY;
+		st->min[c] = INFINITY;
+	}
+
+#if defined(__SSE2__)
+	SilenceDetector_StatsSSE2(buf, bits, channels, n, st);
+#else
+	SilenceDetector_StatsScalar(buf, bits, channels, 0, n, st);
+#endif
+}
+
+// The frame after the last one standing out from the DC offset, only
+// called for segments known to hold one, so it usually stops right away.
+static size_t
+SilenceDetector_LastLoud(const SilenceDetector* sd,
+                         const void* buf,
+                         size_t frames)
+{
+	for (size_t i = frames; i > 0; i--) {
+		for (int c = 0; c < sd->channels; c++) {
+			float v = SilenceDetector_Get(buf, sd->bits,
+			                              (i - 1) * sd->channels + c);
+
+			if (fabsf(v - sd->dc[c]) > sd->on)
+				return i;
+		}
+	}
+
+	return 0;
+}
+
+static void
+SilenceDetector_EndBlock(SilenceDetector* sd)
+{
+	bool quiet = true, loud = false;
+
+	for (int c = 0; c < sd->channels; c++) {
+		float mean = sd->sum[c] / sd->fill;
+		float var = sd->sum_sq[c] / sd->fill - mean * mean;
+		float rms = var > 0.f ? sqrtf(var) : 0.f;
+
+		quiet = quiet && rms <= sd->on;
+		loud = loud || rms > sd->off;
+
+		// the offset of loud blocks says nothing about the level they
+		// settle at
+		if (rms <= sd->off)
+			sd->dc[c] = mean;
+
+		sd->sum[c] = sd->sum_sq[c] = 0.f;
+	}
+
+	if (!sd->silent && quiet) {
+		sd->silent = true;
+		sd->reported = false;
+		sd->start = sd->last_loud;
+	} else if (sd->silent && loud) {
+		sd->silent = false;
+		sd->last_loud = sd->frame;
+	}
+
+	sd->fill = 0;
+}
+
+// Returns true once per silence, when it has lasted the minimum duration.
+bool
+SilenceDetector_Process(SilenceDetector* sd,
+                        const void* buf,
+                        size_t frames)
+{
+	size_t frame_bytes = Sample_FrameBytes(sd->bits, sd->channels);
+	bool r = false;
+
+	assert(sd);
+
+	while (frames > 0) {
+		size_t n = sd->block - sd->fill;
+		SilenceDetector_Stats st;
+
+		n = n < frames ? n : frames;
+
+		SilenceDetector_GetStats(buf, sd->bits, sd->channels,
+		                         n * sd->channels, &st);
+
+		for (int c = 0; c < sd->channels; c++) {
+			sd->sum[c] += st.sum[c];
+			sd->sum_sq[c] += st.sum_sq[c];
+
+			if (!sd->silent && (st.max[c] - sd->dc[c] > sd->on
+			                    || sd->dc[c] - st.min[c] > sd->on)) {
+				size_t last = SilenceDetector_LastLoud(sd, buf, n);
+
+				if (last > 0)
+					sd->last_loud = sd->frame + last;
+			}
+		}
+
+		sd->frame += n;
+		sd->fill += n;
+
+		if (sd->fill == sd->block)
+			SilenceDetector_EndBlock(sd);
+
+		if (sd->silent && !sd->reported
+		        && sd->frame - sd->start >= sd->min_frames) {
+			sd->reported = true;
+			r = true;
+		}
+
+		buf = (const char*) buf + n * frame_bytes;
+		frames -= n;
+	}
+
+	return r;
+}
+
+// The frame the last reported silence began at, counted from the reset.
+size_t
+SilenceDetector_Start(const SilenceDetector* sd)
+{
+	return sd->start;
+}
+
+void
+SilenceDetector_Reset(SilenceDetector* sd)
+{
+	assert(sd);
+
+	sd->frame = sd->fill = 0;
+	sd->last_loud = sd->start = 0;
+	sd->silent = sd->reported = false;
+
+	for (int c = 0; c < SAMPLE_MAX_CH; c++)
+		sd->sum[c] = sd->sum_sq[c] = sd->dc[c] = 0.f;
+}
+
+// Levels in dBFS, the duration in milliseconds. Blocks are 10 ms.
+void
+SilenceDetector_Init(SilenceDetector* sd,
+                     int fs,
+                     int bits,
+                     int channels,
+                     float threshold_db,
+                     float hysteresis_db,
+                     int min_ms)
+{
+	assert(sd);
+	assert(Sample_ValidFormat(fs, bits, channels));
+	assert(hysteresis_db >= 0.f && min_ms >= 0);
+
+	sd->bits = bits;
+	sd->channels = channels;
+	sd->on = powf(10.f, threshold_db / 20.f);
+	sd->off = powf(10.f, (threshold_db + hysteresis_db) / 20.f);
+	sd->block = fs / 100;
+	sd->min_frames = (size_t) fs * min_ms / 1000;
+
+	SilenceDetector_Reset(sd);
+}
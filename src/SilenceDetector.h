@@ -0,0 +1,42 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_SILENCEDETECTOR_H_
+#define SRC_SILENCEDETECTOR_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "Sample.h"
+
+// Finds where a stream falls silent, one block at a time. A block is
+// quiet when the RMS of every channel, around its DC offset, is at or
+// below the threshold, and silence only ends at a block above threshold
+// plus hysteresis. The silence is taken to begin after the last sample
+// that stood out by more than the threshold from the DC offset of the
+// last quiet block, so the start is exact to the frame rather than to the
+// block, unless the offset moves as the track falls silent.
+typedef struct SilenceDetector {
+	int bits, channels;
+	float on, off;
+	size_t block, min_frames;
+
+	// frames seen since the reset, and of the current block
+	size_t frame, fill;
+	float sum[SAMPLE_MAX_CH],
+	      sum_sq[SAMPLE_MAX_CH],
+	      dc[SAMPLE_MAX_CH];
+
+	// one past the last loud frame, only followed outside of silence
+	size_t last_loud;
+	size_t start;
+	bool silent, reported;
+} SilenceDetector;
+
+void   SilenceDetector_Init    (SilenceDetector*, int, int, int,
+                                float, float, int);
+void   SilenceDetector_Reset   (SilenceDetector*);
+bool   SilenceDetector_Process (SilenceDetector*, const void*, size_t);
+size_t SilenceDetector_Start   (const SilenceDetector*);
+
+#endif /* SRC_SILENCEDETECTOR_H_ */
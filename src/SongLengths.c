@@ -0,0 +1,465 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "SongLengths.h"
+#include "Globals.h"
+
+#define SONGLENGTHS_MAGIC "MODPSL01"
+
+// The cache is the header followed by the slots, the entries and the
+// times, laid out the way the index uses them.
+typedef struct SongLengths_Header {
+	char magic[8];
+	uint64_t src_size;
+	int64_t src_mtime;
+	uint32_t nslots,
+	         nentries,
+	         ntimes,
+	         reserved;
+} SongLengths_Header;
+
+static size_t
+SongLengths_Size(const SongLengths_Header* hdr)
+{
+	return sizeof(SongLengths_Header)
+	       + hdr->nslots * sizeof(uint32_t)
+	       + hdr->nentries * sizeof(SongLengths_Entry)
+	       + hdr->ntimes * sizeof(uint32_t);
+}
+
+static void
+SongLengths_SetIndex(SongLengths* sl)
+{
+	const SongLengths_Header* hdr = (const SongLengths_Header*) sl->base;
+	const char* p = (const char*) (hdr + 1);
+
+	sl->slots = (const uint32_t*) p;
+	p += hdr->nslots * sizeof(uint32_t);
+	sl->entries = (const SongLengths_Entry*) p;
+	p += hdr->nentries * sizeof(SongLengths_Entry);
+	sl->times = (const uint32_t*) p;
+	sl->mask = hdr->nslots - 1;
+}
+
+static uint32_t
+SongLengths_Hash(const uint8_t md5[MD5_DIGEST_LEN])
+{
+	uint32_t h;
+
+	// the digest is as good a hash as any
+	memcpy(&h, md5, sizeof(h));
+
+	return h;
+}
+
+// Maps a whole file read only, or reads it where there is no mmap.
+static void*
+SongLengths_Map(const char* path, size_t* len)
+{
+	struct stat st;
+	void* p;
+
+#ifdef _WIN32
+	FILE* f = fopen(path, "rb");
+
+	if (f == NULL)
+		return NULL;
+
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= 0
+	        || (p = malloc(st.st_size)) == NULL) {
+		fclose(f);
+		return NULL;
+	}
+
+	if (fread(p, 1, st.st_size, f) != (size_t) st.st_size) {
+		free(p);
+		p = NULL;
+	}
+
+	fclose(f);
+#else
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED)
+		return NULL;
+#endif
+
+	*len = st.st_size;
+
+	return p;
+}
+
+static void
+SongLengths_Unmap(void* p, size_t len)
+{
+#ifdef _WIN32
+	(void) len;
+	free(p);
+#else
+	munmap(p, len);
+#endif
+}
+
+static int
+SongLengths_Hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	c = tolower(c);
+
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// m:ss, m:ss.s, m:ss.ss or m:ss.sss, in ms, -1 if p is at none
+static int
+SongLengths_ParseTime(const char** pp, const char* end)
+{
+	const char* p = *pp;
+	int min = 0, sec = 0, ms = 0, scale = 100;
+
+	if (p == end || !isdigit((unsigned char) *p))
+		return -1;
+
+	for (; p < end && isdigit((unsigned char) *p); p++)
+		min = min * 10 + *p - '0';
+
+	if (p == end || *p++ != ':')
+		return -1;
+
+	for (; p < end && isdigit((unsigned char) *p); p++)
+		sec = sec * 10 + *p - '0';
+
+	if (p < end && *p == '.')
+		for (p++; p < end && isdigit((unsigned char) *p); p++, scale /= 10)
+			ms += (*p - '0') * scale;
+
+	// attributes like (G) or (M) of the old format
+	if (p < end && *p == '(')
+		while (p < end && *p != ')' && *p != '\n')
+			p++;
+
+	if (p < end && *p == ')')
+		p++;
+
+	*pp = p;
+
+	return (min * 60 + sec) * 1000 + ms;
+}
+
+// Parses the database text into entries and times, each sized for the
+// worst case, and returns the number of entries.
+static uint32_t
+SongLengths_Parse(const char* text,
+                  size_t len,
+                  SongLengths_Entry* entries,
+                  uint32_t* times,
+                  uint32_t* ntimes)
+{
+	const char* end = text + len;
+	const char* p = text;
+	uint32_t n = 0;
+
+	*ntimes = 0;
+
+	while (p < end) {
+		const char* eol = memchr(p, '\n', end - p);
+		SongLengths_Entry* e = &entries[n];
+		int i, t;
+
+		eol = eol ? eol : end;
+
+		for (i = 0; i < MD5_DIGEST_LEN * 2 && p + i < eol; i++) {
+			int hi = SongLengths_Hex(p[i]);
+
+			if (hi < 0)
+				break;
+
+			e->md5[i / 2] = i % 2 ? e->md5[i / 2] | hi : hi << 4;
+		}
+
+		// comments, section headers and anything malformed
+		if (i < MD5_DIGEST_LEN * 2 || p + i >= eol || p[i] != '=') {
+			p = eol + 1;
+			continue;
+		}
+
+		e->first = *ntimes;
+		e->songs = 0;
+
+		for (p += i + 1; p < eol; ) {
+			if (*p == ' ' || *p == '\t' || *p == '\r') {
+				p++;
+				continue;
+			}
+
+			if ((t = SongLengths_ParseTime(&p, eol)) < 0)
+				break;
+
+			times[(*ntimes)++] = t;
+			e->songs++;
+		}
+
+		if (e->songs > 0)
+			n++;
+
+		p = eol + 1;
+	}
+
+	return n;
+}
+
+// Builds the index in the cache layout from the database text.
+static SongLengths_Header*
+SongLengths_Build(const char* text,
+                  size_t len,
+                  const struct stat* st)
+{
+	SongLengths_Header hdr;
+	SongLengths_Header* r;
+	SongLengths_Entry* entries;
+	uint32_t* times;
+	uint32_t* slots;
+	size_t lines = 1, colons = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		lines += text[i] == '\n';
+		colons += text[i] == ':';
+	}
+
+	entries = (SongLengths_Entry*) malloc(lines * sizeof(SongLengths_Entry));
+	times = (uint32_t*) malloc((colons + 1) * sizeof(uint32_t));
+
+	if (entries == NULL || times == NULL) {
+		free(entries);
+		free(times);
+		return NULL;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SONGLENGTHS_MAGIC, sizeof(hdr.magic));
+	hdr.src_size = st->st_size;
+	hdr.src_mtime = st->st_mtime;
+	hdr.nentries = SongLengths_Parse(text, len, entries, times, &hdr.ntimes);
+
+	// at most half full, so probes stay short
+	for (hdr.nslots = 16; hdr.nslots < hdr.nentries * 2; hdr.nslots *= 2)
+		;
+
+	r = (SongLengths_Header*) calloc(1, SongLengths_Size(&hdr));
+
+	if (r != NULL) {
+		char* p = (char*) (r + 1);
+
+		*r = hdr;
+
+		slots = (uint32_t*) p;
+		p += hdr.nslots * sizeof(uint32_t);
+		memcpy(p, entries, hdr.nentries * sizeof(SongLengths_Entry));
+		p += hdr.nentries * sizeof(SongLengths_Entry);
+		memcpy(p, times, hdr.ntimes * sizeof(uint32_t));
+
+		for (uint32_t i = 0; i < hdr.nentries; i++) {
+			uint32_t s = SongLengths_Hash(entries[i].md5) & (hdr.nslots - 1);
+
+			while (slots[s] != 0)
+				s = (s + 1) & (hdr.nslots - 1);
+
+			slots[s] = i + 1;
+		}
+	}
+
+	free(entries);
+	free(times);
+
+	return r;
+}
+
+static void
+SongLengths_WriteCache(const char* path,
+                       const SongLengths_Header* hdr)
+{
+	char tmp[MODP_STR_LENGTH];
+	size_t len = SongLengths_Size(hdr);
+	FILE* f;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+		return;
+
+	if ((f = fopen(tmp, "wb")) == NULL)
+		return;
+
+	if (fwrite(hdr, 1, len, f) != len) {
+		fclose(f);
+		remove(tmp);
+		return;
+	}
+
+	fclose(f);
+
+	// written whole before it replaces the old one
+	remove(path);
+
+	if (rename(tmp, path) != 0)
+		remove(tmp);
+}
+
+// Find trusts the index, so a cache that was cut short or edited by hand
+// is checked through before it is used, and rebuilt if anything is off.
+static bool
+SongLengths_CacheValid(const SongLengths_Header* hdr,
+                       size_t len,
+                       const struct stat* st)
+{
+	const uint32_t* slots;
+	const SongLengths_Entry* entries;
+	bool empty = false;
+
+	if (len < sizeof(SongLengths_Header)
+	        || memcmp(hdr->magic, SONGLENGTHS_MAGIC, sizeof(hdr->magic)) != 0
+	        || hdr->src_size != (uint64_t) st->st_size
+	        || hdr->src_mtime != (int64_t) st->st_mtime
+	        || hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) != 0
+	        || SongLengths_Size(hdr) != len)
+		return false;
+
+	slots = (const uint32_t*) (hdr + 1);
+	entries = (const SongLengths_Entry*) (slots + hdr->nslots);
+
+	for (uint32_t s = 0; s < hdr->nslots; s++) {
+		if (slots[s] > hdr->nentries)
+			return false;
+
+		empty |= slots[s] == 0;
+	}
+
+	for (uint32_t i = 0; i < hdr->nentries; i++) {
+		if ((uint64_t) entries[i].first + entries[i].songs > hdr->ntimes)
+			return false;
+	}
+
+	// a probe only ends at an empty slot
+	return empty;
+}
+
+// Opens the database at path, through its cache when that is up to date.
+// Returns NULL if the database cannot be read.
+SongLengths*
+SongLengths_Open(const char* path)
+{
+	char cache_path[MODP_STR_LENGTH];
+	SongLengths* sl;
+	struct stat st;
+	void* text;
+	size_t len;
+
+	assert(path);
+
+	if (stat(path, &st) != 0)
+		return NULL;
+
+	if (snprintf(cache_path, sizeof(cache_path), "%s.idx", path)
+	        >= (int) sizeof(cache_path))
+		return NULL;
+
+	sl = (SongLengths*) calloc(1, sizeof(SongLengths));
+	assert(sl);
+
+	sl->base = SongLengths_Map(cache_path, &sl->len);
+
+	if (sl->base != NULL) {
+		if (SongLengths_CacheValid(sl->base, sl->len, &st)) {
+			sl->mapped = true;
+			SongLengths_SetIndex(sl);
+			return sl;
+		}
+
+		SongLengths_Unmap(sl->base, sl->len);
+	}
+
+	if ((text = SongLengths_Map(path, &len)) == NULL) {
+		free(sl);
+		return NULL;
+	}
+
+	sl->base = SongLengths_Build(text, len, &st);
+	SongLengths_Unmap(text, len);
+
+	if (sl->base == NULL) {
+		free(sl);
+		return NULL;
+	}
+
+	sl->len = SongLengths_Size(sl->base);
+	SongLengths_SetIndex(sl);
+	SongLengths_WriteCache(cache_path, sl->base);
+
+	return sl;
+}
+
+void
+SongLengths_Close(SongLengths* sl)
+{
+	if (sl == NULL)
+		return;
+
+	if (sl->mapped)
+		SongLengths_Unmap(sl->base, sl->len);
+	else
+		free(sl->base);
+
+	free(sl);
+}
+
+// The length of subsong track, counted from 0, in ms, or -1 if the tune
+// or the subsong is not in the database.
+int
+SongLengths_Find(const SongLengths* sl,
+                 const uint8_t md5[MD5_DIGEST_LEN],
+                 int track)
+{
+	uint32_t s;
+
+	assert(sl);
+
+	for (s = SongLengths_Hash(md5) & sl->mask;
+	     sl->slots[s] != 0;
+	     s = (s + 1) & sl->mask) {
+		const SongLengths_Entry* e = &sl->entries[sl->slots[s] - 1];
+
+		if (memcmp(e->md5, md5, MD5_DIGEST_LEN) != 0)
+			continue;
+
+		if (track < 0 || (uint32_t) track >= e->songs)
+			return -1;
+
+		return (int) sl->times[e->first + track];
+	}
+
+	return -1;
+}
@@ -0,0 +1,42 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_SONGLENGTHS_H_
+#define SRC_SONGLENGTHS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "MD5.h"
+
+typedef struct SongLengths_Entry {
+	uint8_t md5[MD5_DIGEST_LEN];
+	// the subsong lengths are times[first] to times[first + songs - 1]
+	uint32_t first,
+	         songs;
+} SongLengths_Entry;
+
+// The HVSC Songlengths.md5 database, looked up by the MD5 of the whole
+// tune file. The index is a hash table of entries, with the lengths of
+// all subsongs in one array. It is written to a cache file next to the
+// database, which later runs map as is while the database is unchanged.
+typedef struct SongLengths {
+	const uint32_t* slots;
+	const SongLengths_Entry* entries;
+	const uint32_t* times;
+	uint32_t mask;
+
+	// the mapped cache, or the index built in memory
+	void* base;
+	size_t len;
+	bool mapped;
+} SongLengths;
+
+SongLengths* SongLengths_Open  (const char*);
+void         SongLengths_Close (SongLengths*);
+int          SongLengths_Find  (const SongLengths*,
+                                const uint8_t[MD5_DIGEST_LEN],
+                                int);
+
+#endif /* SRC_SONGLENGTHS_H_ */
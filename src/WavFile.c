@@ -0,0 +1,109 @@
+// Copyright intealls
+// License: GPL v3
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WavFile.h"
+#include "Sample.h"
+
+#define WAV_HEADER_SIZE 44
+
+static void
+WavFile_Put16(unsigned char* p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void
+WavFile_Put32(unsigned char* p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static int
+WavFile_WriteHeader(WavFile* wf)
+{
+	unsigned char hdr[WAV_HEADER_SIZE];
+	int block_align = wf->channels * wf->bits / 8;
+
+	memcpy(hdr + 0, "RIFF", 4);
+	WavFile_Put32(hdr + 4, (uint32_t) (WAV_HEADER_SIZE - 8 + wf->data_bytes));
+	memcpy(hdr + 8, "WAVE", 4);
+	memcpy(hdr + 12, "fmt ", 4);
+	WavFile_Put32(hdr + 16, 16);
+	WavFile_Put16(hdr + 20, wf->bits == SAMPLE_F32 ? 3 : 1); // float or PCM
+	WavFile_Put16(hdr + 22, wf->channels);
+	WavFile_Put32(hdr + 24, wf->fs);
+	WavFile_Put32(hdr + 28, wf->fs * block_align);
+	WavFile_Put16(hdr + 32, block_align);
+	WavFile_Put16(hdr + 34, wf->bits);
+	memcpy(hdr + 36, "data", 4);
+	WavFile_Put32(hdr + 40, (uint32_t) wf->data_bytes);
+
+	if (fseek(wf->f, 0, SEEK_SET) != 0)
+		return 1;
+
+	return fwrite(hdr, 1, WAV_HEADER_SIZE, wf->f) != WAV_HEADER_SIZE;
+}
+
+size_t
+WavFile_Write(WavFile* wf,
+              const void* data,
+              size_t len)
+{
+	size_t written;
+
+	assert(wf);
+
+	written = fwrite(data, 1, len, wf->f);
+	wf->data_bytes += written;
+
+	return written;
+}
+
+void
+WavFile_Close(WavFile* wf)
+{
+	assert(wf);
+
+	// the header is rewritten with the final sizes
+	if (WavFile_WriteHeader(wf))
+		fprintf(stderr, "WavFile: failed to finalize header\n");
+
+	fclose(wf->f);
+	free(wf);
+}
+
+WavFile*
+WavFile_Open(const char* path, int fs, int bits, int channels)
+{
+	WavFile* wf;
+
+	assert(bits == SAMPLE_S16 || bits == SAMPLE_F32);
+
+	wf = (WavFile*) calloc(1, sizeof(WavFile));
+	assert(wf);
+
+	wf->fs = fs;
+	wf->bits = bits;
+	wf->channels = channels;
+	wf->data_bytes = 0;
+
+	wf->f = fopen(path, "wb");
+
+	if (wf->f == NULL || WavFile_WriteHeader(wf)) {
+		if (wf->f != NULL)
+			fclose(wf->f);
+		free(wf);
+		return NULL;
+	}
+
+	return wf;
+}
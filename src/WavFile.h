@@ -0,0 +1,20 @@
+// Copyright intealls
+// License: GPL v3
+
+#ifndef SRC_WAVFILE_H_
+#define SRC_WAVFILE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+typedef struct WavFile {
+	FILE* f;
+	int fs, bits, channels;
+	size_t data_bytes;
+} WavFile;
+
+WavFile* WavFile_Open  (const char*, int, int, int);
+size_t   WavFile_Write (WavFile*, const void*, size_t);
+void     WavFile_Close (WavFile*);
+
+#endif /* SRC_WAVFILE_H_ */
@@ -11,14 +11,28 @@
 #include <xmp.h>
 
 #include "XMPRenderer.h"
+#include "Sample.h"
+#include "MinMax.h"
 #include "Globals.h"
 
+#define XMP_QUALITIES (4)
+
+// interpolation and effects by quality level
+static const int XMPRenderer_Interp[XMP_QUALITIES] = {
+	XMP_INTERP_SPLINE, XMP_INTERP_LINEAR, XMP_INTERP_LINEAR, XMP_INTERP_NEAREST
+};
+
+static const int XMPRenderer_DSP[XMP_QUALITIES] = {
+	XMP_DSP_LOWPASS, XMP_DSP_LOWPASS, 0, 0
+};
+
 typedef struct XMPRenderer_Data {
 	char title[MODP_STR_LENGTH];
 	char info[MODP_STR_LENGTH];
 	xmp_context ctx;
 	struct xmp_module_info mod;
 	size_t song_length;
+	int quality;
 	_Atomic size_t total_frames_rendered;
 	int fs, bits, channels;
 } XMPRenderer_Data;
@@ -28,16 +42,28 @@ typedef struct XMPRenderer_Data {
 	assert((a)); \
 	DebugPrint((b));
 
+// libxmp only takes these from a started player
+static void
+XMPRenderer_ApplyQuality(XMPRenderer_Data* rndr_data)
+{
+	xmp_set_player(rndr_data->ctx, XMP_PLAYER_INTERP,
+	               XMPRenderer_Interp[rndr_data->quality]);
+	xmp_set_player(rndr_data->ctx, XMP_PLAYER_DSP,
+	               XMPRenderer_DSP[rndr_data->quality]);
+}
+
 static int
 XMPRenderer_Load(const AudioRenderer* obj,
                  const char* filename,
                  const void* data,
-                 const size_t len)
+                 const size_t len,
+                 void* prepared)
 {
 	char* info_ptr = NULL;
 	size_t info_copied = 0;
 
 	(void) filename;
+	(void) prepared;
 
 	DataObject(rndr_data, obj);
 
@@ -72,7 +98,10 @@ XMPRenderer_Load(const AudioRenderer* obj,
 
 	rndr_data->song_length = rndr_data->mod.seq_data[0].duration / 1000;
 
-	xmp_start_player(rndr_data->ctx, rndr_data->fs, 0);
+	xmp_start_player(rndr_data->ctx, rndr_data->fs,
+	                 rndr_data->channels == 1 ? XMP_FORMAT_MONO : 0);
+
+	XMPRenderer_ApplyQuality(rndr_data);
 
 	return 0;
 }
@@ -80,15 +109,78 @@ XMPRenderer_Load(const AudioRenderer* obj,
 static bool
 XMPRenderer_CanLoad(const AudioRenderer* obj,
                     const void* data,
-                    const size_t len)
+                    const size_t len,
+                    void** prepared)
 {
 	struct xmp_test_info test_info;
 
+	(void) prepared;
+
 	DataObject(rndr_data, obj);
 
 	return xmp_test_module_from_memory(data, len, &test_info) == 0;
 }
 
+// the common module signatures, formats without one are found by
+// extension and probed
+static const AudioRenderer_Sig XMPRenderer_SigTable[] = {
+	{ "Extended Module: ", 0, 17, NULL, ARC_CERTAIN },
+	{ "IMPM", 0, 4, NULL, ARC_CERTAIN },
+	{ "SCRM", 44, 4, NULL, ARC_CERTAIN },
+	{ "PTMF", 44, 4, NULL, ARC_CERTAIN },
+	{ "!Scream!", 20, 8, NULL, ARC_CERTAIN },
+	{ "BMOD2STM", 20, 8, NULL, ARC_CERTAIN },
+	{ "MMD0", 0, 4, NULL, ARC_CERTAIN },
+	{ "MMD1", 0, 4, NULL, ARC_CERTAIN },
+	{ "MMD2", 0, 4, NULL, ARC_CERTAIN },
+	{ "MMD3", 0, 4, NULL, ARC_CERTAIN },
+	{ "OKTASONG", 0, 8, NULL, ARC_CERTAIN },
+	{ "FAR\xfe", 0, 4, NULL, ARC_CERTAIN },
+	{ "DMDL", 0, 4, NULL, ARC_CERTAIN },
+	{ "GDM\xfe", 0, 4, NULL, ARC_CERTAIN },
+	{ "DBM0", 0, 4, NULL, ARC_CERTAIN },
+	{ "MAS_UTrack_V00", 0, 14, NULL, ARC_CERTAIN },
+	{ "M.K.", 1080, 4, NULL, ARC_CERTAIN },
+	{ "M!K!", 1080, 4, NULL, ARC_CERTAIN },
+	{ "M&K!", 1080, 4, NULL, ARC_CERTAIN },
+	{ "FLT4", 1080, 4, NULL, ARC_CERTAIN },
+	{ "FLT8", 1080, 4, NULL, ARC_CERTAIN },
+	{ "4CHN", 1080, 4, NULL, ARC_CERTAIN },
+	{ "6CHN", 1080, 4, NULL, ARC_CERTAIN },
+	{ "8CHN", 1080, 4, NULL, ARC_CERTAIN },
+	{ "CD81", 1080, 4, NULL, ARC_CERTAIN },
+	{ "OKTA", 1080, 4, NULL, ARC_CERTAIN },
+	{ "MTM", 0, 3, NULL, ARC_WEAK },
+	{ "AMF", 0, 3, NULL, ARC_WEAK },
+	{ "if", 0, 2, NULL, ARC_WEAK },
+	{ "JN", 0, 2, NULL, ARC_WEAK },
+	{ NULL, 0, 0, "mod", ARC_EXT },
+	{ NULL, 0, 0, "xm", ARC_EXT },
+	{ NULL, 0, 0, "it", ARC_EXT },
+	{ NULL, 0, 0, "s3m", ARC_EXT },
+	{ NULL, 0, 0, "stm", ARC_EXT },
+	{ NULL, 0, 0, "mtm", ARC_EXT },
+	{ NULL, 0, 0, "med", ARC_EXT },
+	{ NULL, 0, 0, "okt", ARC_EXT },
+	{ NULL, 0, 0, "ptm", ARC_EXT },
+	{ NULL, 0, 0, "far", ARC_EXT },
+	{ NULL, 0, 0, "mdl", ARC_EXT },
+	{ NULL, 0, 0, "gdm", ARC_EXT },
+	{ NULL, 0, 0, "dbm", ARC_EXT },
+	{ NULL, 0, 0, "ult", ARC_EXT },
+	{ NULL, 0, 0, "amf", ARC_EXT },
+	{ NULL, 0, 0, "669", ARC_EXT },
+	{ NULL, 0, 0, NULL, ARC_NONE }
+};
+
+static const AudioRenderer_Sig*
+XMPRenderer_Sigs(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return XMPRenderer_SigTable;
+}
+
 static bool
 XMPRenderer_Loaded(const AudioRenderer* obj)
 {
@@ -115,6 +207,15 @@ XMPRenderer_UnLoad(const AudioRenderer* obj)
 	}
 }
 
+static void
+XMPRenderer_RenderS16(void* user, int16_t* buf, size_t frames)
+{
+	XMPRenderer_Data* rndr_data = (XMPRenderer_Data*) user;
+
+	xmp_play_buffer(rndr_data->ctx, buf,
+	                frames * rndr_data->channels * sizeof(int16_t), 0);
+}
+
 static int
 XMPRenderer_Render(const AudioRenderer* obj,
                    void* buf,
@@ -122,12 +223,12 @@ XMPRenderer_Render(const AudioRenderer* obj,
 {
 	DataObject(rndr_data, obj);
 
-	int16_t* rndr_buf = (int16_t*) buf;
-
-	size_t byte_scale = (rndr_data->bits / 8) * rndr_data->channels;
+	size_t byte_scale = Sample_FrameBytes(rndr_data->bits, rndr_data->channels);
 	size_t to_render = len / byte_scale;
 
-	xmp_play_buffer(rndr_data->ctx, rndr_buf, len, 0);
+	// libxmp mixes int16 only, mono is done natively
+	Sample_RenderS16(XMPRenderer_RenderS16, rndr_data, rndr_data->channels,
+	                 buf, rndr_data->bits, rndr_data->channels, to_render);
 
 	rndr_data->total_frames_rendered += to_render;
 
@@ -175,6 +276,52 @@ XMPRenderer_Length(const AudioRenderer* obj)
 	return 0;
 }
 
+// modules play on at their end, the song length is where they stop
+static bool
+XMPRenderer_Ended(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return false;
+}
+
+// libxmp starts the order the time falls in, which the play time does
+// not follow, it is at most an order ahead.
+static int
+XMPRenderer_Seek(const AudioRenderer* obj, int ms)
+{
+	DataObject(rndr_data, obj);
+
+	if (xmp_get_player(rndr_data->ctx, XMP_PLAYER_STATE) != XMP_STATE_PLAYING
+	        || xmp_seek_time(rndr_data->ctx, ms) < 0)
+		return -1;
+
+	rndr_data->total_frames_rendered = (size_t) ms * rndr_data->fs / 1000;
+
+	return ms;
+}
+
+static bool
+XMPRenderer_CanSeekFast(const AudioRenderer* obj)
+{
+	(void) obj;
+
+	return true;
+}
+
+static int
+XMPRenderer_SetQuality(const AudioRenderer* obj, int level)
+{
+	DataObject(rndr_data, obj);
+
+	rndr_data->quality = min_int(level, XMP_QUALITIES - 1);
+
+	if (xmp_get_player(rndr_data->ctx, XMP_PLAYER_STATE) >= XMP_STATE_PLAYING)
+		XMPRenderer_ApplyQuality(rndr_data);
+
+	return rndr_data->quality;
+}
+
 static void
 XMPRenderer_Destroy(AudioRenderer* obj)
 {
@@ -234,6 +381,7 @@ XMPRenderer_Create(int fs, int bits, int channels)
 
 		_vtable.Load     = (*XMPRenderer_Load);
 		_vtable.CanLoad  = (*XMPRenderer_CanLoad);
+		_vtable.Sigs     = (*XMPRenderer_Sigs);
 		_vtable.Loaded   = (*XMPRenderer_Loaded);
 		_vtable.UnLoad   = (*XMPRenderer_UnLoad);
 		_vtable.Render   = (*XMPRenderer_Render);
@@ -244,6 +392,10 @@ XMPRenderer_Create(int fs, int bits, int channels)
 		_vtable.SetTrack = (*XMPRenderer_SetTrack);
 		_vtable.PlayTime = (*XMPRenderer_PlayTime);
 		_vtable.Length   = (*XMPRenderer_Length);
+		_vtable.Ended    = (*XMPRenderer_Ended);
+		_vtable.Seek     = (*XMPRenderer_Seek);
+		_vtable.CanSeekFast = (*XMPRenderer_CanSeekFast);
+		_vtable.SetQuality = (*XMPRenderer_SetQuality);
 		_vtable.Destroy  = (*XMPRenderer_Destroy);
 
 		_initialized = true;
@@ -266,8 +418,6 @@ XMPRenderer_Create(int fs, int bits, int channels)
 	assert(rndr_data->ctx);
 
 	xmp_set_player(rndr_data->ctx, XMP_PLAYER_DEFPAN, 50);
-	xmp_set_player(rndr_data->ctx, XMP_PLAYER_INTERP, XMP_INTERP_SPLINE);
-	xmp_set_player(rndr_data->ctx, XMP_PLAYER_DSP, XMP_DSP_LOWPASS);
 
 	return arndr;
 }